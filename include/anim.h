@@ -0,0 +1,206 @@
+#ifndef ANIM_H
+#define ANIM_H
+
+#include<stdlib.h>
+#include<stdio.h>
+
+#include "geom.h"
+#include "scene.h"
+#include "out.h"
+
+//
+// `Keyframe` declaration
+
+typedef struct Keyframe {
+    size_t frame;
+    Camera camera;
+} Keyframe;
+
+//
+// `Track` declaration, per-frame motion of a single DYNAMIC object
+
+typedef enum TrackType { TRACK_SPHERE, TRACK_MESH } TrackType;
+
+typedef struct Track {
+    TrackType tt;
+    union {
+        Sphere* sphere;
+        Mesh* mesh;
+    };
+    Transform* ts;
+} Track;
+
+//
+// `Sequence` declaration
+
+typedef struct Sequence {
+    size_t frames;
+    size_t kc;
+    Keyframe* keys;
+    size_t tc;
+    Track* tracks;
+} Sequence;
+
+Sequence sequence_new(size_t frames) {
+    return (Sequence) {
+        .frames = frames,
+        .kc = 0,
+        .keys = NULL,
+        .tc = 0,
+        .tracks = NULL
+    };
+}
+
+void sequence_free(Sequence* seq) {
+    size_t i;
+    for(i = 0; i < seq->tc; i++) free(seq->tracks[i].ts);
+
+    free(seq->keys);
+    free(seq->tracks);
+}
+
+// Keyframes are kept sorted, a keyframe on an existing frame replaces it
+void sequence_add_keyframe(Sequence* seq, size_t frame, Camera camera) {
+    size_t i;
+    for(i = 0; i < seq->kc && seq->keys[i].frame < frame; i++);
+
+    if(i < seq->kc && seq->keys[i].frame == frame) {
+        seq->keys[i].camera = camera;
+        return;
+    }
+
+    seq->keys = realloc(seq->keys, (seq->kc + 1) * sizeof *(seq->keys));
+    memmove(&seq->keys[i + 1], &seq->keys[i], (seq->kc - i) * sizeof *(seq->keys));
+
+    seq->keys[i] = (Keyframe) { .frame = frame, .camera = camera };
+    seq->kc++;
+}
+
+Track* helper_sequence_add_track(Sequence* seq, TrackType tt, Transform* ts) {
+    seq->tracks = realloc(seq->tracks, (seq->tc + 1) * sizeof *(seq->tracks));
+
+    Track* track = &seq->tracks[seq->tc++];
+    track->tt = tt;
+    track->ts = malloc(seq->frames * sizeof *(track->ts));
+
+    memcpy(track->ts, ts, seq->frames * sizeof *(track->ts));
+
+    return track;
+}
+
+// `ts` holds one `Transform` per frame, applied on top of the previous frames
+// A zero translation leaves the object, and the hierarchy, untouched for that frame
+void sequence_add_sphere_track(Sequence* seq, Sphere* sphere, Transform* ts) {
+    helper_sequence_add_track(seq, TRACK_SPHERE, ts)->sphere = sphere;
+}
+
+void sequence_add_mesh_track(Sequence* seq, Mesh* mesh, Transform* ts) {
+    helper_sequence_add_track(seq, TRACK_MESH, ts)->mesh = mesh;
+}
+
+// Linearly interpolates `pos` and `at` between the surrounding keyframes
+Camera sequence_camera(Sequence* seq, size_t frame) {
+    assert(seq->kc && "Error: Sequence has no camera keyframes");
+
+    if(frame <= seq->keys[0].frame) return seq->keys[0].camera;
+
+    size_t i;
+    for(i = 1; i < seq->kc; i++) {
+        Keyframe a = seq->keys[i - 1];
+        Keyframe b = seq->keys[i];
+
+        if(frame > b.frame) continue;
+
+        double t = (double) (frame - a.frame) / (double) (b.frame - a.frame);
+
+        return (Camera) {
+            .pos = add_vv(a.camera.pos, mul_vs(sub_vv(b.camera.pos, a.camera.pos), t)),
+            .at = add_vv(a.camera.at, mul_vs(sub_vv(b.camera.at, a.camera.at), t))
+        };
+    }
+
+    return seq->keys[seq->kc - 1].camera;
+}
+
+// Applies every `Track`'s transform for `frame`, returns 1 if anything moved
+int helper_sequence_apply(Sequence* seq, size_t frame) {
+    int moved = 0;
+
+    size_t i;
+    for(i = 0; i < seq->tc; i++) {
+        Track* track = &seq->tracks[i];
+        Transform t = track->ts[frame];
+
+        if(t.tt == TRANSLATE && !t.a.x && !t.a.y && !t.a.z) continue;
+
+        switch(track->tt) {
+            case TRACK_SPHERE:
+                moved |= !sphere_transform(track->sphere, t);
+                break;
+            case TRACK_MESH:
+                moved |= !mesh_transform(track->mesh, t);
+                break;
+        }
+    }
+
+    return moved;
+}
+
+//
+// Render a `Sequence`
+
+// Renders every frame to `pattern` (a printf format taking the frame number), reusing
+// the static hierarchy, both frame `Buffer`s and the `Writer` machinery throughout
+// Only the DYNAMIC hierarchy is refit, and only on frames where something moved
+// Frame N is rendered while frame N - 1 is still being written in the background
+// Returns 1 if any frame failed to write
+int raytrace_sequence(Scene* s, Config c, Sequence* seq, size_t w, size_t h, char* pattern, ImageFormat fmt) {
+    assert(s->tt && "Error: Scene was not initialized");
+
+    scene_track_dynamic(s);
+
+    Buffer buffers[2] = { buffer_wh(w, h), buffer_wh(w, h) };
+
+    size_t name_len = strlen(pattern) + 32;
+    char* name = malloc(name_len);
+
+    int failed = 0;
+
+    Writer* pending = NULL;
+
+    size_t frame;
+    for(frame = 0; frame < seq->frames; frame++) {
+        Buffer b = buffers[frame % 2];
+
+        if(helper_sequence_apply(seq, frame)) scene_refit(s);
+        if(seq->kc) s->camera = sequence_camera(seq, frame);
+
+        snprintf(name, name_len, pattern, (unsigned) frame);
+
+        Writer* wr = writer_open(b, name, fmt);
+        failed |= !wr;
+
+        Config fc = c;
+        if(wr) {
+            fc.on_block = helper_writer_hook;
+            fc.on_block_data = wr;
+        }
+
+        raytrace(b, *s, fc);
+
+        // The previous frame has had this whole render to finish writing
+        if(pending) failed |= writer_close(pending);
+        pending = wr;
+    }
+
+    if(pending) failed |= writer_close(pending);
+
+    free(name);
+
+    buffer_free(&buffers[0]);
+    buffer_free(&buffers[1]);
+
+    return failed;
+}
+
+#endif /* ANIM_H */
@@ -3,28 +3,84 @@
 
 #include<stdlib.h>
 #include<stdio.h>
+#include<math.h>
+#include<assert.h>
+#include<float.h>
+#include<string.h>
+#include<sys/mman.h>
+
+#include "lalg.h"
 
 //
 // `Buffer` declaration
 
+// Pixels are stored in row-major order unless `tile` is set, in which case the
+// image is split into `tile` x `tile` squares (row-major) with Z-ordered pixels
+// `mapped` is the length of a shared mapping holding `vs`, or 0 if it is on the heap
+// `shared` is set when processes forked afterwards write into the same pixels, whether
+// or not the `Buffer` owns them
 typedef struct Buffer {
     size_t w;
     size_t h;
+    size_t tile;
     char* vs;
+    size_t mapped;
+    int shared;
 } Buffer;
 
 Buffer buffer_wh(size_t w, size_t h) {
     Buffer init = (Buffer) {
         .w = w,
         .h = h,
-        .vs = calloc(3 * w * h, sizeof *(init.vs))
+        .tile = 0,
+        .vs = calloc(3 * w * h, sizeof *(init.vs)),
+        .mapped = 0,
+        .shared = 0
+    };
+
+    return init;
+}
+
+// `tile` must be a power of two no larger than 256, storage is padded to whole tiles
+Buffer buffer_wh_tiled(size_t w, size_t h, size_t tile) {
+    assert((tile && tile <= 256 && !(tile & (tile - 1))) &&
+        "Error: Buffer tile size must be a power of two no larger than 256");
+
+    size_t pw = (w + tile - 1) / tile * tile;
+    size_t ph = (h + tile - 1) / tile * tile;
+
+    Buffer init = (Buffer) {
+        .w = w,
+        .h = h,
+        .tile = tile,
+        .vs = calloc(3 * pw * ph, sizeof *(init.vs)),
+        .mapped = 0,
+        .shared = 0
     };
 
     return init;
 }
 
+// Pixels live in a shared mapping, so processes forked afterwards write into the
+// same image. Returns a `Buffer` with NULL `vs` if the mapping fails
+Buffer buffer_wh_shared(size_t w, size_t h) {
+    size_t len = MAX(1, 3 * w * h);
+
+    void* vs = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    return (Buffer) {
+        .w = w,
+        .h = h,
+        .tile = 0,
+        .vs = (vs == MAP_FAILED) ? NULL : vs,
+        .mapped = (vs == MAP_FAILED) ? 0 : len,
+        .shared = vs != MAP_FAILED
+    };
+}
+
 void buffer_free(Buffer* b) {
-    free(b->vs);
+    if(b->mapped) munmap(b->vs, b->mapped);
+    else free(b->vs);
 }
 
 void buffer_print(Buffer* b) {
@@ -60,26 +116,73 @@ void helper_size_t_write_digits(char* s, size_t* i, size_t val, size_t len) {
     *i += len;
 }
 
+// Interleaves the low 8 bits of `x` and `y`
+size_t helper_buffer_morton(size_t x, size_t y) {
+    size_t i, m = 0;
+    for(i = 0; i < 8; i++)
+        m |= ((x >> i) & 1) << (2 * i) | ((y >> i) & 1) << (2 * i + 1);
+
+    return m;
+}
+
+// Byte offset of the pixel at (`x`, `y`) in `b.vs`
+size_t helper_buffer_index(Buffer b, size_t x, size_t y) {
+    if(!b.tile) return 3 * (x + y * b.w);
+
+    size_t tw = (b.w + b.tile - 1) / b.tile;
+    size_t t = x / b.tile + (y / b.tile) * tw;
+
+    return 3 * (t * b.tile * b.tile + helper_buffer_morton(x % b.tile, y % b.tile));
+}
+
 //
 // Set pixel
 
+void buffer_pack_pixel(char* px, Vec c) {
+    px[0] = (char) (int) (c.x * 255.);
+    px[1] = (char) (int) (c.y * 255.);
+    px[2] = (char) (int) (c.z * 255.);
+}
+
 void buffer_set_pixel(Buffer b, size_t x, size_t y, Vec c) {
-    int i = 3 * (x + y * b.w);
+    buffer_pack_pixel(b.vs + helper_buffer_index(b, x, y), c);
+}
 
-    b.vs[i + 0] = (char) (int) (c.x * 255.);
-    b.vs[i + 1] = (char) (int) (c.y * 255.);
-    b.vs[i + 2] = (char) (int) (c.z * 255.);
+// Copies a row-major `tile` of `tw` x `th` pixels to (`x`, `y`) in the `Buffer`
+void buffer_write_tile(Buffer b, size_t x, size_t y, size_t tw, size_t th, char* tile) {
+    size_t i, j;
+    for(j = 0; j < th; j++) {
+        if(!b.tile) {
+            memcpy(b.vs + helper_buffer_index(b, x, y + j), tile + 3 * j * tw, 3 * tw);
+            continue;
+        }
+
+        for(i = 0; i < tw; i++)
+            memcpy(b.vs + helper_buffer_index(b, x + i, y + j), tile + 3 * (i + j * tw), 3);
+    }
+}
+
+// Copies row `y` of the image into `row` in row-major order
+void buffer_read_row(Buffer b, size_t y, char* row) {
+    if(!b.tile) {
+        memcpy(row, b.vs + helper_buffer_index(b, 0, y), 3 * b.w);
+        return;
+    }
+
+    size_t x;
+    for(x = 0; x < b.w; x++) memcpy(row + 3 * x, b.vs + helper_buffer_index(b, x, y), 3);
 }
 
 //
 // Write Buffer to `ppm` image
 
-void buffer_export_as_ppm(Buffer b, char* file) {
+// Returns the `ppm` header for `b`, its length is written to `s_len`
+char* helper_buffer_ppm_header(Buffer b, size_t* s_len) {
     size_t w_len = helper_size_t_length(b.w);
     size_t h_len = helper_size_t_length(b.h);
 
-    size_t s_len = 9 + w_len + h_len;
-    char* s = (char*) malloc(s_len);
+    *s_len = 9 + w_len + h_len;
+    char* s = (char*) malloc(*s_len);
 
     s[0] = 'P';
     s[1] = '6';
@@ -99,14 +202,124 @@ void buffer_export_as_ppm(Buffer b, char* file) {
     s[i++] = '5';
     s[i++] = (char) 10;
 
+    return s;
+}
+
+// Returns 1 if the file could not be opened
+int buffer_export_as_ppm(Buffer b, char* file) {
+    size_t s_len;
+    char* s = helper_buffer_ppm_header(b, &s_len);
+
     FILE* f;
     if((f = fopen(file, "wb+"))) {
         fwrite(s, 1, s_len, f);
-        fwrite(b.vs, 1, 3 * b.w * b.h, f);
+
+        if(!b.tile)
+            fwrite(b.vs, 1, 3 * b.w * b.h, f);
+        else {
+            char* row = malloc(3 * b.w);
+
+            size_t y;
+            for(y = 0; y < b.h; y++) {
+                buffer_read_row(b, y, row);
+                fwrite(row, 1, 3 * b.w, f);
+            }
+
+            free(row);
+        }
+
+        fclose(f);
     }
 
-    fclose(f);
     free(s);
+
+    return !f;
+}
+
+//
+// `Accum` declaration, a floating point buffer that accumulates samples
+
+typedef struct Accum {
+    size_t w;
+    size_t h;
+    Vec* sum;
+    double* sq;
+    size_t* ns;
+} Accum;
+
+Accum accum_wh(size_t w, size_t h) {
+    Accum init = (Accum) {
+        .w = w,
+        .h = h,
+        .sum = calloc(w * h, sizeof *(init.sum)),
+        .sq = calloc(w * h, sizeof *(init.sq)),
+        .ns = calloc(w * h, sizeof *(init.ns))
+    };
+
+    return init;
 }
- 
+
+void accum_free(Accum* a) {
+    free(a->sum);
+    free(a->sq);
+    free(a->ns);
+}
+
+void accum_clear(Accum a) {
+    memset(a.sum, 0, a.w * a.h * sizeof *(a.sum));
+    memset(a.sq, 0, a.w * a.h * sizeof *(a.sq));
+    memset(a.ns, 0, a.w * a.h * sizeof *(a.ns));
+}
+
+double helper_accum_luminance(Vec c) {
+    return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+}
+
+void accum_add_sample(Accum a, size_t x, size_t y, Vec c) {
+    size_t i = x + y * a.w;
+
+    double l = helper_accum_luminance(c);
+
+    a.sum[i] = add_vv(a.sum[i], c);
+    a.sq[i] += l * l;
+    a.ns[i]++;
+}
+
+Vec accum_get_pixel(Accum a, size_t x, size_t y) {
+    size_t i = x + y * a.w;
+
+    return (a.ns[i]) ? div_vs(a.sum[i], (double) a.ns[i]) : vec_aaa(0.);
+}
+
+// Mean standard error of pixel luminance, pixels with fewer than two samples are skipped
+double accum_noise(Accum a) {
+    double total = 0.;
+    size_t count = 0;
+
+    size_t i;
+    for(i = 0; i < a.w * a.h; i++) {
+        if(a.ns[i] < 2) continue;
+
+        double n = (double) a.ns[i];
+        double mean = helper_accum_luminance(a.sum[i]) / n;
+        double var = (a.sq[i] - n * mean * mean) / (n - 1.);
+
+        total += sqrt(MAX(0., var) / n);
+        count++;
+    }
+
+    return (count) ? total / (double) count : DBL_MAX;
+}
+
+// Resolves the accumulated samples into the 8-bit `Buffer`
+void accum_export(Accum a, Buffer b) {
+    assert((a.w == b.w && a.h == b.h) &&
+        "Error: Accumulation buffer and Buffer dimensions differ");
+
+    size_t x, y;
+    for(y = 0; y < a.h; y++)
+        for(x = 0; x < a.w; x++)
+            buffer_set_pixel(b, x, y, clamp_v(accum_get_pixel(a, x, y), 0., 1.));
+}
+
 #endif /* BUFFER_H */
\ No newline at end of file
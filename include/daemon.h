@@ -0,0 +1,538 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<pthread.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<sys/time.h>
+#include<sys/un.h>
+
+#include "rt.h"
+#include "anim.h"
+#include "out.h"
+
+#define DAEMON_MAGIC 0x51525452u
+#define DAEMON_PATH 256
+#define DAEMON_BACKLOG 16
+#define DAEMON_READERS 64
+#define DAEMON_TIMEOUT 5
+#define DAEMON_MOVES 4096
+#define DAEMON_MAX_DIM 16384
+
+//
+// Wire format, native byte order since the socket never leaves the machine
+
+// A request is a `DaemonRequest` followed by `mc` `DaemonMove`s, answered by a `DaemonReply`
+typedef enum DaemonOp { DAEMON_RENDER = 0, DAEMON_SHUTDOWN } DaemonOp;
+
+typedef enum DaemonStatus { DAEMON_OK = 0, DAEMON_FAILED, DAEMON_INVALID } DaemonStatus;
+
+typedef struct DaemonRequest {
+    unsigned magic;
+    unsigned op;
+    unsigned scene;
+    unsigned w;
+    unsigned h;
+    unsigned format;
+    unsigned aa_samples;
+    unsigned max_depth;
+    unsigned light_samples;
+    unsigned mc;
+    double camera[6];
+    char path[DAEMON_PATH];
+} DaemonRequest;
+
+// Moves one of the objects exposed with `daemon_expose_*`, on top of earlier moves
+typedef struct DaemonMove {
+    unsigned object;
+    unsigned tt;
+    double a[3];
+    double t;
+} DaemonMove;
+
+typedef struct DaemonReply {
+    unsigned magic;
+    int status;
+    double seconds;
+} DaemonReply;
+
+//
+// `Daemon` declaration, initialized `Scene`s kept resident and rendered on request
+
+// Each connection is read by a thread of its own, so a slow client holds up no one else,
+// and queued as a `DaemonJob`. Jobs are rendered one at a time, each with every thread
+// of the `Config`. `readers` counts the reading threads, at most DAEMON_READERS
+typedef struct DaemonObject {
+    size_t scene;
+    TrackType tt;
+    union {
+        Sphere* sphere;
+        Mesh* mesh;
+    };
+} DaemonObject;
+
+typedef struct DaemonJob {
+    int fd;
+    DaemonRequest req;
+    DaemonMove* moves;
+} DaemonJob;
+
+typedef struct Daemon {
+    char path[sizeof ((struct sockaddr_un*) 0)->sun_path];
+    int fd;
+    size_t sc;
+    Scene** scenes;
+    size_t oc;
+    DaemonObject* objects;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t jc;
+    DaemonJob* jobs;
+    size_t readers;
+    int closing;
+} Daemon;
+
+typedef struct DaemonReader {
+    Daemon* d;
+    int fd;
+} DaemonReader;
+
+Daemon* daemon_new(char* path) {
+    assert(strlen(path) < sizeof ((struct sockaddr_un*) 0)->sun_path &&
+        "Error: Daemon socket path is too long");
+
+    Daemon* d = malloc(sizeof *d);
+
+    snprintf(d->path, sizeof d->path, "%s", path);
+    d->fd = -1;
+    d->sc = 0;
+    d->scenes = NULL;
+    d->oc = 0;
+    d->objects = NULL;
+    d->jc = 0;
+    d->jobs = NULL;
+    d->readers = 0;
+    d->closing = 0;
+
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+
+    return d;
+}
+
+// The `Scene`s stay owned by the caller
+void daemon_free(Daemon* d) {
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->cond);
+
+    free(d->scenes);
+    free(d->objects);
+    free(d->jobs);
+    free(d);
+}
+
+// Returns the id requests use to refer to the `Scene`
+size_t daemon_add_scene(Daemon* d, Scene* s) {
+    assert(s->tt && "Error: Scene was not initialized");
+
+    scene_track_dynamic(s);
+
+    d->scenes = realloc(d->scenes, (d->sc + 1) * sizeof *(d->scenes));
+    d->scenes[d->sc] = s;
+
+    return d->sc++;
+}
+
+int helper_daemon_listed(SLL* head, void* item) {
+    for(; head; head = head->next) if(head->item == item) return 1;
+
+    return 0;
+}
+
+// Only DYNAMIC objects may move, since `scene_refit` leaves the static hierarchy as built
+size_t helper_daemon_expose(Daemon* d, size_t scene, TrackType tt, void* object) {
+    assert(scene < d->sc && "Error: Daemon has no such scene");
+
+    Scene* s = d->scenes[scene];
+    assert(helper_daemon_listed((tt == TRACK_SPHERE) ? s->d_spheres : s->d_meshes, object) &&
+        "Error: Only DYNAMIC objects of the scene can be exposed");
+
+    d->objects = realloc(d->objects, (d->oc + 1) * sizeof *(d->objects));
+
+    DaemonObject* o = &d->objects[d->oc];
+    o->scene = scene;
+    o->tt = tt;
+
+    if(tt == TRACK_SPHERE) o->sphere = (Sphere*) object;
+    else o->mesh = (Mesh*) object;
+
+    return d->oc++;
+}
+
+// Lets requests move a DYNAMIC object of `scene`, returns the id they refer to it by
+size_t daemon_expose_sphere(Daemon* d, size_t scene, Sphere* sphere) {
+    return helper_daemon_expose(d, scene, TRACK_SPHERE, sphere);
+}
+
+size_t daemon_expose_mesh(Daemon* d, size_t scene, Mesh* mesh) {
+    return helper_daemon_expose(d, scene, TRACK_MESH, mesh);
+}
+
+//
+// Helper functions
+
+// Reads or writes all `len` bytes, returns 1 on failure or a closed connection
+int helper_daemon_read(int fd, void* data, size_t len) {
+    char* at = (char*) data;
+
+    while(len) {
+        ssize_t n = read(fd, at, len);
+        if(n <= 0) return 1;
+
+        at += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+int helper_daemon_write(int fd, void* data, size_t len) {
+    char* at = (char*) data;
+
+    while(len) {
+        ssize_t n = send(fd, at, len, MSG_NOSIGNAL);
+        if(n <= 0) return 1;
+
+        at += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+void helper_daemon_reply(int fd, int status, double seconds) {
+    DaemonReply reply = (DaemonReply) {
+        .magic = DAEMON_MAGIC,
+        .status = status,
+        .seconds = seconds
+    };
+
+    helper_daemon_write(fd, &reply, sizeof reply);
+    close(fd);
+}
+
+// Returns 1 if the request cannot be served, `Config` is needed for the block size
+int helper_daemon_invalid(Daemon* d, Config c, DaemonJob* job) {
+    DaemonRequest* r = &job->req;
+
+    if(r->scene >= d->sc || !r->w || !r->h) return 1;
+    if(r->w > DAEMON_MAX_DIM || r->h > DAEMON_MAX_DIM) return 1;
+    if(r->w % c.block_size || r->h % c.block_size) return 1;
+    if(r->format > QOI || !memchr(r->path, 0, DAEMON_PATH)) return 1;
+
+    size_t i;
+    for(i = 0; i < r->mc; i++) {
+        DaemonMove* m = &job->moves[i];
+
+        if(m->object >= d->oc || d->objects[m->object].scene != r->scene) return 1;
+        if(m->tt > TRANSLATE) return 1;
+    }
+
+    return 0;
+}
+
+// Body of a connection's thread, which reads its request and queues it
+void* helper_daemon_receive(void* data) {
+    DaemonReader* reader = (DaemonReader*) data;
+
+    Daemon* d = reader->d;
+    int fd = reader->fd;
+
+    free(reader);
+
+    struct timeval timeout = (struct timeval) { .tv_sec = DAEMON_TIMEOUT, .tv_usec = 0 };
+
+    // A stalled client must not keep its thread forever
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    DaemonJob job = (DaemonJob) { .fd = fd, .moves = NULL };
+
+    int invalid = helper_daemon_read(fd, &job.req, sizeof job.req) || job.req.magic != DAEMON_MAGIC;
+
+    if(!invalid && job.req.op == DAEMON_SHUTDOWN) {
+        pthread_mutex_lock(&d->lock);
+        d->closing = 1;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+
+        helper_daemon_reply(fd, DAEMON_OK, 0.);
+        fd = -1;
+    }
+
+    invalid = invalid || job.req.mc > DAEMON_MOVES;
+
+    if(fd >= 0 && !invalid && job.req.mc) {
+        job.moves = malloc(job.req.mc * sizeof *(job.moves));
+
+        invalid = helper_daemon_read(fd, job.moves, job.req.mc * sizeof *(job.moves));
+    }
+
+    if(fd >= 0 && invalid) {
+        free(job.moves);
+        helper_daemon_reply(fd, DAEMON_INVALID, 0.);
+        fd = -1;
+    }
+
+    // Once closing, nothing dequeues jobs any more. The `Daemon` may be freed as soon as
+    // `readers` drops, so it is not touched afterwards
+    pthread_mutex_lock(&d->lock);
+
+    int closing = d->closing;
+
+    if(fd >= 0 && !closing) {
+        d->jobs = realloc(d->jobs, (d->jc + 1) * sizeof *(d->jobs));
+        d->jobs[d->jc++] = job;
+    }
+
+    d->readers--;
+
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+
+    if(fd >= 0 && closing) {
+        free(job.moves);
+        helper_daemon_reply(fd, DAEMON_FAILED, 0.);
+    }
+
+    return NULL;
+}
+
+// Hands every connection to a thread of its own, until the `Daemon` is closing
+void* helper_daemon_accept(void* data) {
+    Daemon* d = (Daemon*) data;
+
+    for(;;) {
+        int fd = accept(d->fd, NULL, NULL);
+
+        if(fd < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+
+        pthread_mutex_lock(&d->lock);
+
+        // The listening socket itself failed, so no shutdown request can ever arrive
+        if(fd < 0) {
+            d->closing = 1;
+            pthread_cond_broadcast(&d->cond);
+        }
+
+        int closing = d->closing;
+        int full = d->readers >= DAEMON_READERS;
+
+        if(!closing && !full) d->readers++;
+
+        pthread_mutex_unlock(&d->lock);
+
+        if(closing) {
+            if(fd >= 0) helper_daemon_reply(fd, DAEMON_FAILED, 0.);
+            break;
+        }
+
+        if(full) {
+            helper_daemon_reply(fd, DAEMON_FAILED, 0.);
+            continue;
+        }
+
+        DaemonReader* reader = malloc(sizeof *reader);
+        reader->d = d;
+        reader->fd = fd;
+
+        pthread_t thread;
+        if(!pthread_create(&thread, NULL, helper_daemon_receive, reader)) {
+            pthread_detach(thread);
+            continue;
+        }
+
+        free(reader);
+        helper_daemon_reply(fd, DAEMON_FAILED, 0.);
+
+        pthread_mutex_lock(&d->lock);
+        d->readers--;
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    return NULL;
+}
+
+// Connects to the `Daemon`'s own socket, so the accepting thread returns from `accept`
+void helper_daemon_wake(Daemon* d) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s", d->path);
+
+    connect(fd, (struct sockaddr*) &addr, sizeof addr);
+    close(fd);
+}
+
+// Applies the job's moves, then renders it to its path
+int helper_daemon_render(Daemon* d, Config c, DaemonJob* job) {
+    DaemonRequest* r = &job->req;
+    Scene* s = d->scenes[r->scene];
+
+    // Allocated first, so a request that cannot be rendered leaves the `Scene` unmoved
+    Buffer b = buffer_wh(r->w, r->h);
+    if(!b.vs) return 1;
+
+    int moved = 0;
+
+    size_t i;
+    for(i = 0; i < r->mc; i++) {
+        DaemonMove* m = &job->moves[i];
+        DaemonObject* o = &d->objects[m->object];
+
+        Transform t = (Transform) {
+            .tt = (TransformType) m->tt,
+            .a = vec_abc(m->a[0], m->a[1], m->a[2]),
+            .t = m->t
+        };
+
+        if(o->tt == TRACK_SPHERE) moved |= !sphere_transform(o->sphere, t);
+        else moved |= !mesh_transform(o->mesh, t);
+    }
+
+    if(moved) scene_refit(s);
+
+    Scene view = *s;
+    view.camera = (Camera) {
+        .pos = vec_abc(r->camera[0], r->camera[1], r->camera[2]),
+        .at = vec_abc(r->camera[3], r->camera[4], r->camera[5])
+    };
+
+    if(r->aa_samples) c.aa_samples = r->aa_samples;
+    if(r->max_depth) c.max_depth = r->max_depth;
+    if(r->light_samples) c.light_samples = r->light_samples;
+
+    int failed = raytrace_to_file(b, view, c, r->path, (ImageFormat) r->format);
+
+    buffer_free(&b);
+
+    return failed;
+}
+
+//
+// Serving
+
+// Listens on the `Daemon`'s path and renders requests in arrival order, until a
+// DAEMON_SHUTDOWN request arrives and the queued jobs are done
+// Request fields left at 0 keep the value from `c`. Returns 1 if the socket cannot be
+// opened, or if something other than a socket is in the way at the `Daemon`'s path
+int daemon_run(Daemon* d, Config c) {
+    d->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(d->fd < 0) return 1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s", d->path);
+
+    // A socket left behind by an earlier run is replaced, anything else is kept
+    struct stat st;
+    int stale = !lstat(d->path, &st);
+
+    if(stale && !S_ISSOCK(st.st_mode)) {
+        close(d->fd);
+        return 1;
+    }
+
+    if(stale) unlink(d->path);
+
+    if(bind(d->fd, (struct sockaddr*) &addr, sizeof addr) || listen(d->fd, DAEMON_BACKLOG)) {
+        close(d->fd);
+        return 1;
+    }
+
+    pthread_t acceptor;
+    if(pthread_create(&acceptor, NULL, helper_daemon_accept, d)) {
+        close(d->fd);
+        unlink(d->path);
+        return 1;
+    }
+
+    for(;;) {
+        pthread_mutex_lock(&d->lock);
+
+        while(!d->jc && !d->closing) pthread_cond_wait(&d->cond, &d->lock);
+
+        if(!d->jc) {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+
+        DaemonJob job = d->jobs[0];
+        memmove(d->jobs, d->jobs + 1, --d->jc * sizeof *(d->jobs));
+
+        pthread_mutex_unlock(&d->lock);
+
+        double start = omp_get_wtime();
+
+        int status = DAEMON_INVALID;
+        if(!helper_daemon_invalid(d, c, &job))
+            status = (helper_daemon_render(d, c, &job)) ? DAEMON_FAILED : DAEMON_OK;
+
+        helper_daemon_reply(job.fd, status, omp_get_wtime() - start);
+
+        free(job.moves);
+    }
+
+    helper_daemon_wake(d);
+    pthread_join(acceptor, NULL);
+
+    // Readers still running give up within DAEMON_TIMEOUT and queue nothing
+    pthread_mutex_lock(&d->lock);
+    while(d->readers) pthread_cond_wait(&d->cond, &d->lock);
+    pthread_mutex_unlock(&d->lock);
+
+    close(d->fd);
+    unlink(d->path);
+
+    return 0;
+}
+
+//
+// Client side
+
+// Sends a request with its moves and waits for the reply, returns 1 on failure
+int daemon_request(char* path, DaemonRequest* req, DaemonMove* moves, DaemonReply* reply) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return 1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+
+    req->magic = DAEMON_MAGIC;
+
+    int failed = connect(fd, (struct sockaddr*) &addr, sizeof addr) != 0;
+
+    failed = failed || helper_daemon_write(fd, req, sizeof *req);
+    failed = failed || (req->mc && helper_daemon_write(fd, moves, req->mc * sizeof *moves));
+    failed = failed || helper_daemon_read(fd, reply, sizeof *reply);
+    failed = failed || reply->magic != DAEMON_MAGIC;
+
+    close(fd);
+
+    return failed;
+}
+
+#endif /* DAEMON_H */
@@ -0,0 +1,210 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include<stdlib.h>
+#include<string.h>
+#include<float.h>
+
+#include "rt.h"
+
+//
+// `Dirty` declaration, the blocks of a `Buffer` that need to be traced again
+
+typedef struct Dirty {
+    size_t block_size;
+    size_t block_w;
+    size_t block_h;
+    char* blocks;
+} Dirty;
+
+Dirty dirty_new(Buffer b, Config c) {
+    assert((b.w % c.block_size == 0 && b.h % c.block_size == 0) &&
+        "Error: Image dimensions must be cleanly divisible by block size");
+
+    Dirty init = (Dirty) {
+        .block_size = c.block_size,
+        .block_w = b.w / c.block_size,
+        .block_h = b.h / c.block_size,
+        .blocks = NULL
+    };
+
+    init.blocks = calloc(init.block_w * init.block_h, sizeof *(init.blocks));
+
+    return init;
+}
+
+void dirty_free(Dirty* d) {
+    free(d->blocks);
+}
+
+void dirty_clear(Dirty* d) {
+    memset(d->blocks, 0, d->block_w * d->block_h);
+}
+
+void dirty_mark_all(Dirty* d) {
+    memset(d->blocks, 1, d->block_w * d->block_h);
+}
+
+size_t dirty_count(Dirty* d) {
+    size_t i, count = 0;
+    for(i = 0; i < d->block_w * d->block_h; i++) count += (size_t) d->blocks[i];
+
+    return count;
+}
+
+//
+// Helper functions
+
+// Secondary rays can carry a change anywhere in the image, so such scenes are never partial
+int helper_dirty_has_bounces(Scene s) {
+    SLL* curr;
+    for(curr = s.materials; curr; curr = curr->next) {
+        Material* m = (Material*) curr->item;
+
+        if(m->reflectivity > 0. || m->transparency > 0.) return 1;
+    }
+
+    return 0;
+}
+
+// Bounds of everything that can receive a shadow
+void helper_dirty_scene_extrema(Scene s, Vec* minima, Vec* maxima) {
+    *minima = s.tt->minima;
+    *maxima = s.tt->maxima;
+
+    size_t i;
+    for(i = 0; i < s.dsc; i++) helper_bvh_surface_extrema(s.d_surfaces[i], minima, maxima);
+}
+
+// Grows the screen rectangle to include `p`, returns 0 if `p` cannot be projected
+int helper_dirty_push(Scene s, Buffer b, Vec p, double* x0, double* y0, double* x1, double* y1) {
+    double x, y;
+    if(!camera_project(s, b.h, b.w, p, &x, &y)) return 0;
+
+    *x0 = MIN(*x0, x);
+    *y0 = MIN(*y0, y);
+    *x1 = MAX(*x1, x);
+    *y1 = MAX(*y1, y);
+
+    return 1;
+}
+
+//
+// Marking changed regions
+
+// Marks every block covered by the box and by the shadow it casts away from each `Light`
+// Call it with the bounds of an object both before and after it is transformed
+void dirty_mark_bounds(Dirty* d, Scene s, Buffer b, Vec minima, Vec maxima) {
+    if(helper_dirty_has_bounces(s)) {
+        dirty_mark_all(d);
+        return;
+    }
+
+    Vec s_min, s_max;
+    helper_dirty_scene_extrema(s, &s_min, &s_max);
+
+    helper_bvh_push_extrema(minima, &s_min, &s_max);
+    helper_bvh_push_extrema(maxima, &s_min, &s_max);
+
+    // Shadows are followed far enough to leave everything they could fall on
+    double reach = dist_vv(s_min, s_max);
+
+    double x0 = DBL_MAX, y0 = DBL_MAX;
+    double x1 = -1. * DBL_MAX, y1 = -1. * DBL_MAX;
+
+    size_t i;
+    for(i = 0; i < 8; i++) {
+        Vec corner = (Vec) {
+            (i & 1) ? maxima.x : minima.x,
+            (i & 2) ? maxima.y : minima.y,
+            (i & 4) ? maxima.z : minima.z
+        };
+
+        int visible = helper_dirty_push(s, b, corner, &x0, &y0, &x1, &y1);
+
+        SLL* curr;
+        for(curr = s.lights; curr && visible; curr = curr->next) {
+            Light light = *(Light*) curr->item;
+
+            if(helper_bvh_contains_point(minima, maxima, light.pos)) {
+                visible = 0;
+                break;
+            }
+
+            Vec far = add_vv(corner, mul_vs(norm_v(sub_vv(corner, light.pos)), reach));
+
+            visible = helper_dirty_push(s, b, far, &x0, &y0, &x1, &y1);
+        }
+
+        // Geometry behind the camera, or a light inside the box, can touch any pixel
+        if(!visible) {
+            dirty_mark_all(d);
+            return;
+        }
+    }
+
+    // Rays pass through pixel corners, so pad by a pixel on each side
+    if(x1 < -1. || y1 < -1. || x0 > (double) b.w || y0 > (double) b.h) return;
+
+    size_t bx0 = (size_t) MAX(0., x0 - 1.) / d->block_size;
+    size_t by0 = (size_t) MAX(0., y0 - 1.) / d->block_size;
+    size_t bx1 = MIN(d->block_w - 1, (size_t) MIN((double) b.w, x1 + 1.) / d->block_size);
+    size_t by1 = MIN(d->block_h - 1, (size_t) MIN((double) b.h, y1 + 1.) / d->block_size);
+
+    size_t bx, by;
+    for(by = by0; by <= by1; by++)
+        for(bx = bx0; bx <= bx1; bx++) d->blocks[bx + by * d->block_w] = 1;
+}
+
+void dirty_mark_sphere(Dirty* d, Scene s, Buffer b, Sphere* sphere) {
+    Vec a = vec_aaa(sphere->radius);
+
+    dirty_mark_bounds(d, s, b, sub_vv(sphere->center, a), add_vv(sphere->center, a));
+}
+
+void dirty_mark_mesh(Dirty* d, Scene s, Buffer b, Mesh* mesh) {
+    Vec minima = vec_aaa(DBL_MAX);
+    Vec maxima = vec_aaa(-1. * DBL_MAX);
+
+    size_t i;
+    for(i = 0; i < mesh->tc; i++) {
+        Surface sf = (Surface) { .st = TRI, .tri = &mesh->tris[i] };
+
+        helper_bvh_surface_extrema(sf, &minima, &maxima);
+    }
+
+    dirty_mark_bounds(d, s, b, minima, maxima);
+}
+
+//
+// Incremental `raytrace` function
+
+// Traces only the marked blocks into the existing `Buffer`, then clears the marks
+// Returns the number of blocks traced
+size_t raytrace_dirty(Buffer b, Scene s, Config c, Dirty* d) {
+    Block* blocks = malloc(MAX(1, d->block_w * d->block_h) * sizeof *blocks);
+
+    size_t i, bc = 0;
+    for(i = 0; i < d->block_w * d->block_h; i++) {
+        if(!d->blocks[i]) continue;
+
+        size_t x_start = i % d->block_w * d->block_size;
+        size_t y_start = i / d->block_w * d->block_size;
+
+        blocks[bc++] = (Block) {
+            .x_start = x_start,
+            .x_end = x_start + d->block_size,
+            .y_start = y_start,
+            .y_end = y_start + d->block_size
+        };
+    }
+
+    raytrace_blocks(b, s, c, blocks, bc);
+
+    dirty_clear(d);
+    free(blocks);
+
+    return bc;
+}
+
+#endif /* DIRTY_H */
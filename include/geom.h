@@ -1,6 +1,8 @@
 #ifndef GEOM_H
 #define GEOM_H
 
+#include<assert.h>
+
 #include "lalg.h"
 
 #define EPS_TRI 0.0000001
@@ -42,6 +44,9 @@ struct Material {
     Vec color_spec;
     double luster;
     double metallicity;
+    double reflectivity;
+    double transparency;
+    double ior;
 };
 
 //
@@ -150,7 +155,7 @@ double sphere_intersection(Sphere s, Ray r, double t_min, double t_max) {
     (w < t_max && w > t_min) ? w = w / len : (w = -1.);
 
     if(t > 0. && w == -1.) return t;
-    if(w > 0. && w == -1.) return w;
+    if(w > 0. && t == -1.) return w;
 
     if(t > 0. && w > 0.) return MIN(t, w);
 
@@ -170,16 +175,116 @@ int sphere_transform(Sphere* s, Transform t) {
     }
 }
 
+//
+// `SphereBatch` declaration, up to `SPHERE_BATCH` spheres in structure-of-arrays form
+
+#define SPHERE_BATCH 8
+
+// Unused lanes have a radius of 0 and are masked out by `count`
+typedef struct SphereBatch {
+    double x[SPHERE_BATCH];
+    double y[SPHERE_BATCH];
+    double z[SPHERE_BATCH];
+    double radius[SPHERE_BATCH];
+    Sphere* spheres[SPHERE_BATCH];
+    size_t count;
+} SphereBatch;
+
+SphereBatch sphere_batch_new(Sphere** spheres, size_t count) {
+    assert(count <= SPHERE_BATCH && "Error: Too many spheres for one batch");
+
+    SphereBatch init;
+    init.count = count;
+
+    size_t i;
+    for(i = 0; i < SPHERE_BATCH; i++) {
+        Sphere* s = (i < count) ? spheres[i] : NULL;
+
+        init.x[i] = (s) ? s->center.x : 0.;
+        init.y[i] = (s) ? s->center.y : 0.;
+        init.z[i] = (s) ? s->center.z : 0.;
+        init.radius[i] = (s) ? s->radius : 0.;
+        init.spheres[i] = s;
+    }
+
+    return init;
+}
+
+// Tests every lane at once with the same arithmetic as `sphere_intersection`, normalizing
+// the ray direction a single time. Returns the lane hit first, or `count` on a miss
+// `excl` is skipped, the distance of the hit is written to `t`
+size_t sphere_batch_intersection(SphereBatch* b, Ray r, Sphere* excl, double t_min, double t_max, double* t) {
+    double len = len_v(r.dir);
+    Vec dir = norm_v(r.dir);
+
+    double miss = t_max + 1.;
+    double ts[SPHERE_BATCH];
+
+    size_t i;
+    #pragma omp simd
+    for(i = 0; i < SPHERE_BATCH; i++) {
+        double lx = b->x[i] - r.origin.x;
+        double ly = b->y[i] - r.origin.y;
+        double lz = b->z[i] - r.origin.z;
+
+        double rad_sq = b->radius[i] * b->radius[i];
+
+        double tca = lx * dir.x + ly * dir.y + lz * dir.z;
+        double d_sq = (lx * lx + ly * ly + lz * lz) - tca * tca;
+
+        double thc = sqrt(MAX(0., rad_sq - d_sq));
+
+        double near = tca - thc;
+        double far = tca + thc;
+
+        near = (near < t_max && near > t_min) ? near / len : -1.;
+        far = (far < t_max && far > t_min) ? far / len : -1.;
+
+        double hit = (near > 0. && far > 0.) ? MIN(near, far) : 
+            (near > 0.) ? near : (far > 0.) ? far : miss;
+
+        ts[i] = (i >= b->count || d_sq > rad_sq) ? miss : hit;
+    }
+
+    size_t best = b->count;
+    *t = miss;
+
+    for(i = 0; i < b->count; i++) {
+        if(ts[i] < *t && b->spheres[i] != excl) {
+            *t = ts[i];
+            best = i;
+        }
+    }
+
+    return best;
+}
+
 //
 // `Light` declaration
 
+// A `radius` of 0 gives the light unbounded reach
 typedef struct Light {
     Vec pos;
     double strength;
+    double radius;
 } Light;
 
 Light light_new(Vec pos, double strength) {
-    return (Light) { .pos = pos, .strength = strength };
+    return (Light) { .pos = pos, .strength = strength, .radius = 0. };
+}
+
+Light light_new_bounded(Vec pos, double strength, double radius) {
+    return (Light) { .pos = pos, .strength = strength, .radius = radius };
+}
+
+// Smoothly falls off to 0 at the light's radius, always 1 for unbounded lights
+double light_attenuation(Light* l, Vec p) {
+    if(l->radius <= 0.) return 1.;
+
+    double k = distsq_vv(l->pos, p) / (l->radius * l->radius);
+    if(k >= 1.) return 0.;
+
+    return (1. - k) * (1. - k);
 }
 
 void light_print_internal(Light* l, char* name, size_t indent) {
@@ -193,8 +298,10 @@ void light_print_internal(Light* l, char* name, size_t indent) {
     vec_print_internal(&(l->pos), "pos", indent + 1);
     
     printf(
-        "%.*s    strength: %lf\n%.*s}\n", 
+        "%.*s    strength: %lf\n"
+        "%.*s    radius: %lf\n%.*s}\n", 
         id, PADDING, l->strength,
+        id, PADDING, l->radius,
         id, PADDING
     );
 }
@@ -0,0 +1,403 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<assert.h>
+#include<float.h>
+#include<math.h>
+#include<omp.h>
+
+#include "geom.h"
+#include "intrs.h"
+
+#define GRID_DENSITY 2.
+#define GRID_MAX 256
+#define GRID_REFINE 16
+#define GRID_EPS 0.000001
+
+//
+// `Grid` declaration, a uniform grid of cells listing the surfaces overlapping them
+
+// Cells are stored x fastest, `items` index `surfaces` and are sorted within each cell
+// In a two-level grid, crowded cells point to a finer `Grid` of their own in `sub`
+typedef struct Grid Grid;
+
+struct Grid {
+    Vec minima;
+    Vec maxima;
+    size_t n[3];
+    Vec cell;
+    Surface* surfaces;
+    size_t* offsets;
+    unsigned* items;
+    Grid** sub;
+};
+
+//
+// Helper functions
+
+int helper_grid_cmp(const void* a, const void* b) {
+    unsigned ua = *(unsigned*) a;
+    unsigned ub = *(unsigned*) b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+size_t helper_grid_clamp(double v, size_t n) {
+    return (size_t) MIN((double) (n - 1), MAX(0., floor(v)));
+}
+
+// Cell coordinates of the corners of `s`'s box, clamped to the grid
+void helper_grid_range(Grid* g, Surface s, size_t* lo, size_t* hi) {
+    Vec mn = vec_aaa(DBL_MAX);
+    Vec mx = vec_aaa(-1. * DBL_MAX);
+
+    helper_bvh_surface_extrema(s, &mn, &mx);
+
+    double pad = GRID_EPS * dist_vv(g->minima, g->maxima);
+
+    mn = sub_vv(mn, vec_aaa(pad));
+    mx = add_vv(mx, vec_aaa(pad));
+
+    lo[0] = helper_grid_clamp((mn.x - g->minima.x) / g->cell.x, g->n[0]);
+    lo[1] = helper_grid_clamp((mn.y - g->minima.y) / g->cell.y, g->n[1]);
+    lo[2] = helper_grid_clamp((mn.z - g->minima.z) / g->cell.z, g->n[2]);
+
+    hi[0] = helper_grid_clamp((mx.x - g->minima.x) / g->cell.x, g->n[0]);
+    hi[1] = helper_grid_clamp((mx.y - g->minima.y) / g->cell.y, g->n[1]);
+    hi[2] = helper_grid_clamp((mx.z - g->minima.z) / g->cell.z, g->n[2]);
+}
+
+// Roughly `GRID_DENSITY` cells per surface, shaped like the box
+void helper_grid_resolution(Vec minima, Vec maxima, size_t count, size_t* n) {
+    Vec d = sub_vv(maxima, minima);
+
+    double volume = MAX(DBL_MIN, MAX(d.x, DBL_MIN) * MAX(d.y, DBL_MIN) * MAX(d.z, DBL_MIN));
+    double k = cbrt(GRID_DENSITY * (double) count / volume);
+
+    n[0] = (size_t) MIN(GRID_MAX, MAX(1., ceil(d.x * k)));
+    n[1] = (size_t) MIN(GRID_MAX, MAX(1., ceil(d.y * k)));
+    n[2] = (size_t) MIN(GRID_MAX, MAX(1., ceil(d.z * k)));
+}
+
+// Builds a grid over `count` surfaces, given by `subset` or the first `count` of `surfaces`
+// Counting and filling run in parallel, refined cells when `refine` is set
+Grid* helper_grid_build(Surface* surfaces, unsigned* subset, size_t count, Vec minima, Vec maxima, int refine) {
+    Grid* g = malloc(sizeof *g);
+
+    g->minima = minima;
+    g->maxima = maxima;
+    g->surfaces = surfaces;
+    g->sub = NULL;
+
+    helper_grid_resolution(minima, maxima, count, g->n);
+
+    g->cell = (Vec) {
+        MAX(DBL_MIN, (maxima.x - minima.x) / (double) g->n[0]),
+        MAX(DBL_MIN, (maxima.y - minima.y) / (double) g->n[1]),
+        MAX(DBL_MIN, (maxima.z - minima.z) / (double) g->n[2])
+    };
+
+    size_t cc = g->n[0] * g->n[1] * g->n[2];
+
+    size_t* counts = calloc(cc, sizeof *counts);
+
+    long i;
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for(i = 0; i < (long) count; i++) {
+        unsigned s = (subset) ? subset[i] : (unsigned) i;
+
+        size_t lo[3], hi[3];
+        helper_grid_range(g, surfaces[s], lo, hi);
+
+        size_t x, y, z;
+        for(z = lo[2]; z <= hi[2]; z++)
+            for(y = lo[1]; y <= hi[1]; y++)
+                for(x = lo[0]; x <= hi[0]; x++) {
+                    #pragma omp atomic
+                    counts[x + g->n[0] * (y + g->n[1] * z)]++;
+                }
+    }
+
+    g->offsets = malloc((cc + 1) * sizeof *(g->offsets));
+    g->offsets[0] = 0;
+
+    size_t c;
+    for(c = 0; c < cc; c++) g->offsets[c + 1] = g->offsets[c] + counts[c];
+
+    g->items = malloc(MAX(1, g->offsets[cc]) * sizeof *(g->items));
+
+    memcpy(counts, g->offsets, cc * sizeof *counts);
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for(i = 0; i < (long) count; i++) {
+        unsigned s = (subset) ? subset[i] : (unsigned) i;
+
+        size_t lo[3], hi[3];
+        helper_grid_range(g, surfaces[s], lo, hi);
+
+        size_t x, y, z;
+        for(z = lo[2]; z <= hi[2]; z++)
+            for(y = lo[1]; y <= hi[1]; y++)
+                for(x = lo[0]; x <= hi[0]; x++) {
+                    size_t slot;
+
+                    #pragma omp atomic capture
+                    slot = counts[x + g->n[0] * (y + g->n[1] * z)]++;
+
+                    g->items[slot] = s;
+                }
+    }
+
+    free(counts);
+
+    // Filling races between threads, sorting keeps cells, and so ties, deterministic
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(i = 0; i < (long) cc; i++) {
+        size_t first = g->offsets[i];
+
+        qsort(g->items + first, g->offsets[i + 1] - first, sizeof *(g->items), helper_grid_cmp);
+    }
+
+    if(!refine) return g;
+
+    g->sub = calloc(cc, sizeof *(g->sub));
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(i = 0; i < (long) cc; i++) {
+        size_t first = g->offsets[i];
+        size_t items = g->offsets[i + 1] - first;
+
+        if(items <= GRID_REFINE) continue;
+
+        size_t x = (size_t) i % g->n[0];
+        size_t y = (size_t) i / g->n[0] % g->n[1];
+        size_t z = (size_t) i / (g->n[0] * g->n[1]);
+
+        Vec mn = (Vec) {
+            minima.x + g->cell.x * (double) x,
+            minima.y + g->cell.y * (double) y,
+            minima.z + g->cell.z * (double) z
+        };
+
+        g->sub[i] = helper_grid_build(surfaces, g->items + first, items, mn, add_vv(mn, g->cell), 0);
+    }
+
+    return g;
+}
+
+//
+// `Grid` functions
+
+// `two_level` refines cells holding more than `GRID_REFINE` surfaces with a grid of their own
+Grid* grid_new(size_t sc, Surface* surfaces, int two_level) {
+    assert(sc && "Error: Unable to build a Grid without surfaces");
+
+    Vec minima = vec_aaa(DBL_MAX);
+    Vec maxima = vec_aaa(-1. * DBL_MAX);
+
+    size_t i;
+    for(i = 0; i < sc; i++) helper_bvh_surface_extrema(surfaces[i], &minima, &maxima);
+
+    return helper_grid_build(surfaces, NULL, sc, minima, maxima, two_level);
+}
+
+void grid_free(Grid* g) {
+    if(!g) return;
+
+    if(g->sub) {
+        size_t i;
+        for(i = 0; i < g->n[0] * g->n[1] * g->n[2]; i++) grid_free(g->sub[i]);
+
+        free(g->sub);
+    }
+
+    free(g->offsets);
+    free(g->items);
+    free(g);
+}
+
+// Grids suit many small surfaces spread evenly through the scene, which is judged from
+// how many of the cells of a coarse grid over surface centers stay empty, and from how
+// large surfaces are compared to those cells
+int grid_suitable(size_t sc, Surface* surfaces) {
+    if(sc < 64) return 0;
+
+    Vec minima = vec_aaa(DBL_MAX);
+    Vec maxima = vec_aaa(-1. * DBL_MAX);
+
+    double extent = 0.;
+
+    size_t i;
+    for(i = 0; i < sc; i++) {
+        Vec mn = vec_aaa(DBL_MAX);
+        Vec mx = vec_aaa(-1. * DBL_MAX);
+
+        helper_bvh_surface_extrema(surfaces[i], &mn, &mx);
+
+        helper_bvh_push_extrema(mn, &minima, &maxima);
+        helper_bvh_push_extrema(mx, &minima, &maxima);
+
+        extent += (mx.x - mn.x) + (mx.y - mn.y) + (mx.z - mn.z);
+    }
+
+    // Around eight surfaces per cell when evenly spread
+    Grid coarse;
+    coarse.minima = minima;
+    coarse.maxima = maxima;
+
+    helper_grid_resolution(minima, maxima, sc / 16, coarse.n);
+
+    coarse.cell = (Vec) {
+        MAX(DBL_MIN, (maxima.x - minima.x) / (double) coarse.n[0]),
+        MAX(DBL_MIN, (maxima.y - minima.y) / (double) coarse.n[1]),
+        MAX(DBL_MIN, (maxima.z - minima.z) / (double) coarse.n[2])
+    };
+
+    size_t cc = coarse.n[0] * coarse.n[1] * coarse.n[2];
+    char* occupied = calloc(cc, 1);
+
+    for(i = 0; i < sc; i++) {
+        Vec mn = vec_aaa(DBL_MAX);
+        Vec mx = vec_aaa(-1. * DBL_MAX);
+
+        helper_bvh_surface_extrema(surfaces[i], &mn, &mx);
+
+        Vec p = mul_vs(add_vv(mn, mx), 0.5);
+
+        size_t x = helper_grid_clamp((p.x - minima.x) / coarse.cell.x, coarse.n[0]);
+        size_t y = helper_grid_clamp((p.y - minima.y) / coarse.cell.y, coarse.n[1]);
+        size_t z = helper_grid_clamp((p.z - minima.z) / coarse.cell.z, coarse.n[2]);
+
+        occupied[x + coarse.n[0] * (y + coarse.n[1] * z)] = 1;
+    }
+
+    size_t empty = 0;
+    for(i = 0; i < cc; i++) empty += !occupied[i];
+
+    free(occupied);
+
+    double mean_extent = extent / (3. * (double) sc);
+    double mean_cell = (coarse.cell.x + coarse.cell.y + coarse.cell.z) / 3.;
+
+    return (double) empty < 0.25 * (double) cc && mean_extent < 0.5 * mean_cell;
+}
+
+void grid_print_internal(Grid* g, char* name, size_t indent) {
+    int id = 4 * (int) indent;
+
+    size_t cc = g->n[0] * g->n[1] * g->n[2];
+    size_t refined = 0;
+
+    size_t i;
+    for(i = 0; g->sub && i < cc; i++) refined += g->sub[i] != NULL;
+
+    if(name)
+        printf("%.*s%s (grid) {\n", id, PADDING, name);
+    else
+        printf("%.*s grid {\n", id, PADDING);
+
+    printf(
+        "%.*s    cells: %u x %u x %u\n"
+        "%.*s    references: %u\n"
+        "%.*s    refined: %u\n%.*s}\n",
+        id, PADDING, (unsigned) g->n[0], (unsigned) g->n[1], (unsigned) g->n[2],
+        id, PADDING, (unsigned) g->offsets[cc],
+        id, PADDING, (unsigned) refined,
+        id, PADDING
+    );
+}
+
+void grid_print(Grid* g) {
+    grid_print_internal(g, NULL, 0);
+}
+
+//
+// 3D-DDA traversal
+
+// Steps through the cells `r` crosses in order, stopping once the closest hit lies
+// within the cell just visited. Surfaces span cells, so a hit beyond the current cell
+// is only kept as a candidate
+Intersection grid_intersection(Grid* g, Ray r, Surface e, double t_min, double t_max) {
+    Intersection intrs = (Intersection) {
+        .s = (Surface) { .st = NONE },
+        .t = t_max + 1.
+    };
+
+    double entry = helper_bvh_box_entry(g->minima, g->maxima, r);
+    if(entry > t_max) return intrs;
+
+    entry = MAX(0., entry);
+
+    Vec p = add_vv(r.origin, mul_vs(r.dir, entry));
+
+    double origin[3] = { r.origin.x, r.origin.y, r.origin.z };
+    double dir[3] = { r.dir.x, r.dir.y, r.dir.z };
+    double lo[3] = { g->minima.x, g->minima.y, g->minima.z };
+    double width[3] = { g->cell.x, g->cell.y, g->cell.z };
+    double at[3] = { p.x, p.y, p.z };
+
+    long cell[3], step[3], n[3];
+    double next[3], delta[3];
+
+    size_t a;
+    for(a = 0; a < 3; a++) {
+        n[a] = (long) g->n[a];
+        cell[a] = (long) helper_grid_clamp((at[a] - lo[a]) / width[a], g->n[a]);
+
+        if(dir[a] > 0.) {
+            step[a] = 1;
+            delta[a] = width[a] / dir[a];
+            next[a] = (lo[a] + width[a] * (double) (cell[a] + 1) - origin[a]) / dir[a];
+        } else if(dir[a] < 0.) {
+            step[a] = -1;
+            delta[a] = -1. * width[a] / dir[a];
+            next[a] = (lo[a] + width[a] * (double) cell[a] - origin[a]) / dir[a];
+        } else {
+            step[a] = 0;
+            delta[a] = DBL_MAX;
+            next[a] = DBL_MAX;
+        }
+    }
+
+    for(;;) {
+        size_t c = (size_t) cell[0] + g->n[0] * ((size_t) cell[1] + g->n[1] * (size_t) cell[2]);
+
+        if(g->sub && g->sub[c]) {
+            Intersection sub = grid_intersection(g->sub[c], r, e, t_min, MIN(t_max, intrs.t));
+
+            if(sub.t < intrs.t) intrs = sub;
+        } else {
+            size_t i;
+            for(i = g->offsets[c]; i < g->offsets[c + 1]; i++) {
+                Surface s;
+                double t = surface_intersection_excl(g->surfaces[g->items[i]], r, e, t_min, MIN(t_max, intrs.t), &s);
+
+                if(t < intrs.t && t <= t_max) {
+                    intrs.s = s;
+                    intrs.t = t;
+                }
+            }
+        }
+
+        size_t axis = (next[0] < next[1]) ? ((next[0] < next[2]) ? 0 : 2) : ((next[1] < next[2]) ? 1 : 2);
+
+        double exit = next[axis];
+        if(intrs.t <= exit || exit > t_max) break;
+
+        cell[axis] += step[axis];
+        if(cell[axis] < 0 || cell[axis] >= n[axis]) break;
+
+        next[axis] += delta[axis];
+    }
+
+    // Misses report `t_max + 1.` like the hierarchies do
+    if(!intrs.s.st) intrs.t = t_max + 1.;
+
+    return intrs;
+}
+
+#endif /* GRID_H */
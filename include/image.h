@@ -0,0 +1,308 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "scene.h"
+
+#define IMAGE_MAGIC 0x474d4953u
+#define IMAGE_VERSION 1
+
+//
+// `SceneImage` declaration, a `Scene`'s objects flattened into one file that is mapped
+// read-only, so any number of processes can load the `Scene` from the same pages
+
+// The file is the header followed by its materials, lights, spheres, meshes and the
+// tris of every mesh in turn. Pointers to materials are stored as indices
+// Everything is in native byte order and layout, so only the same build may read it
+typedef struct ImageHeader {
+    unsigned magic;
+    unsigned version;
+    Camera camera;
+    int strategy;
+    int accel;
+    int batch_spheres;
+    int track_dynamic;
+    unsigned long bits;
+    unsigned long mc;
+    unsigned long lc;
+    unsigned long sc;
+    unsigned long hc;
+    unsigned long tc;
+} ImageHeader;
+
+typedef struct ImageSphere {
+    Vec center;
+    double radius;
+    unsigned long material;
+    int dynamic;
+} ImageSphere;
+
+typedef struct ImageMesh {
+    unsigned long tc;
+    int dynamic;
+} ImageMesh;
+
+typedef struct ImageTri {
+    Vertex a;
+    Vertex b;
+    Vertex c;
+    unsigned long material;
+} ImageTri;
+
+typedef struct SceneImage {
+    size_t len;
+    ImageHeader* hd;
+    Material* materials;
+    Light* lights;
+    ImageSphere* spheres;
+    ImageMesh* meshes;
+    ImageTri* tris;
+} SceneImage;
+
+//
+// Helper functions
+
+size_t helper_image_count(SLL* list) {
+    size_t count = 0;
+    for(; list; list = list->next) count++;
+
+    return count;
+}
+
+// Index of `m` in the `Scene`'s materials, or `mc` if it is not one of them
+unsigned long helper_image_material(SLL* materials, Material* m) {
+    unsigned long i = 0;
+    for(; materials && materials->item != m; materials = materials->next) i++;
+
+    return i;
+}
+
+// Objects are written in list order, returns 1 on failure
+int helper_image_write_spheres(FILE* f, SLL* spheres, SLL* materials, unsigned long mc, int dynamic) {
+    for(; spheres; spheres = spheres->next) {
+        Sphere* sp = (Sphere*) spheres->item;
+
+        ImageSphere is = (ImageSphere) {
+            .center = sp->center,
+            .radius = sp->radius,
+            .material = helper_image_material(materials, sp->material),
+            .dynamic = dynamic
+        };
+
+        if(is.material == mc || fwrite(&is, sizeof is, 1, f) != 1) return 1;
+    }
+
+    return 0;
+}
+
+int helper_image_write_meshes(FILE* f, SLL* meshes, int dynamic) {
+    for(; meshes; meshes = meshes->next) {
+        ImageMesh im = (ImageMesh) { .tc = ((Mesh*) meshes->item)->tc, .dynamic = dynamic };
+
+        if(fwrite(&im, sizeof im, 1, f) != 1) return 1;
+    }
+
+    return 0;
+}
+
+int helper_image_write_tris(FILE* f, SLL* meshes, SLL* materials, unsigned long mc) {
+    for(; meshes; meshes = meshes->next) {
+        Mesh* m = (Mesh*) meshes->item;
+
+        size_t i;
+        for(i = 0; i < m->tc; i++) {
+            ImageTri it = (ImageTri) {
+                .a = m->tris[i].a,
+                .b = m->tris[i].b,
+                .c = m->tris[i].c,
+                .material = helper_image_material(materials, m->tris[i].material)
+            };
+
+            if(it.material == mc || fwrite(&it, sizeof it, 1, f) != 1) return 1;
+        }
+    }
+
+    return 0;
+}
+
+//
+// `SceneImage` functions
+
+// Writes the objects of `s` to `file`, together with how the `Scene` was built: its
+// `strategy`, `accel`, sphere batching, whether DYNAMIC objects are tracked and
+// whether `tt` was compressed. Objects are saved where they are now, so DYNAMIC ones
+// keep their latest transforms. Returns 1 on failure, or if an object's material was
+// not added to the `Scene`
+int scene_image_write(Scene* s, char* file) {
+    size_t tc = 0;
+
+    SLL* curr;
+    for(curr = s->s_meshes; curr; curr = curr->next) tc += ((Mesh*) curr->item)->tc;
+    for(curr = s->d_meshes; curr; curr = curr->next) tc += ((Mesh*) curr->item)->tc;
+
+    ImageHeader hd = (ImageHeader) {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .camera = s->camera,
+        .strategy = (int) s->strategy,
+        .accel = (int) s->accel,
+        .batch_spheres = s->batch_spheres,
+        .track_dynamic = s->dt || s->d_grid,
+        .bits = (s->qt) ? s->qt->bits : 0,
+        .mc = helper_image_count(s->materials),
+        .lc = helper_image_count(s->lights),
+        .sc = helper_image_count(s->s_spheres) + helper_image_count(s->d_spheres),
+        .hc = helper_image_count(s->s_meshes) + helper_image_count(s->d_meshes),
+        .tc = tc
+    };
+
+    FILE* f;
+    if(!(f = fopen(file, "wb"))) return 1;
+
+    int failed = fwrite(&hd, sizeof hd, 1, f) != 1;
+
+    for(curr = s->materials; curr && !failed; curr = curr->next)
+        failed = fwrite(curr->item, sizeof(Material), 1, f) != 1;
+
+    for(curr = s->lights; curr && !failed; curr = curr->next)
+        failed = fwrite(curr->item, sizeof(Light), 1, f) != 1;
+
+    failed = failed ||
+        helper_image_write_spheres(f, s->s_spheres, s->materials, hd.mc, 0) ||
+        helper_image_write_spheres(f, s->d_spheres, s->materials, hd.mc, 1) ||
+        helper_image_write_meshes(f, s->s_meshes, 0) ||
+        helper_image_write_meshes(f, s->d_meshes, 1) ||
+        helper_image_write_tris(f, s->s_meshes, s->materials, hd.mc) ||
+        helper_image_write_tris(f, s->d_meshes, s->materials, hd.mc);
+
+    failed |= fclose(f) != 0;
+
+    if(failed) remove(file);
+
+    return failed;
+}
+
+// Maps `file` read-only, the file may be removed once it is open
+// Returns NULL if it cannot be mapped or is not a whole image written by this build
+SceneImage* scene_image_open(char* file) {
+    int fd = open(file, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) || (size_t) st.st_size < sizeof(ImageHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t len = (size_t) st.st_size;
+
+    void* base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(base == MAP_FAILED) return NULL;
+
+    ImageHeader* hd = (ImageHeader*) base;
+
+    // Each count is bounded by the file length first, so the total cannot overflow
+    int valid = hd->magic == IMAGE_MAGIC && hd->version == IMAGE_VERSION && (hd->sc || hd->hc) &&
+        hd->mc <= len / sizeof(Material) && hd->lc <= len / sizeof(Light) &&
+        hd->sc <= len / sizeof(ImageSphere) && hd->hc <= len / sizeof(ImageMesh) &&
+        hd->tc <= len / sizeof(ImageTri);
+
+    valid = valid && len == sizeof *hd + hd->mc * sizeof(Material) + hd->lc * sizeof(Light) +
+        hd->sc * sizeof(ImageSphere) + hd->hc * sizeof(ImageMesh) + hd->tc * sizeof(ImageTri);
+
+    SceneImage* im = malloc(sizeof *im);
+
+    im->len = len;
+    im->hd = hd;
+    im->materials = (Material*) (hd + 1);
+    im->lights = (Light*) (im->materials + hd->mc);
+    im->spheres = (ImageSphere*) (im->lights + hd->lc);
+    im->meshes = (ImageMesh*) (im->spheres + hd->sc);
+    im->tris = (ImageTri*) (im->meshes + hd->hc);
+
+    size_t i, tc = 0;
+    for(i = 0; i < hd->sc && valid; i++) valid = im->spheres[i].material < hd->mc;
+    for(i = 0; i < hd->hc && valid; i++) valid = (tc += im->meshes[i].tc) <= hd->tc;
+    for(i = 0; i < hd->tc && valid; i++) valid = im->tris[i].material < hd->mc;
+
+    if(!valid || tc != hd->tc) {
+        munmap(base, len);
+        free(im);
+        return NULL;
+    }
+
+    return im;
+}
+
+// Builds a `Scene` from the image, initialized the way the saved one was
+// Objects are added back to front, so every list keeps the order it was saved in
+Scene scene_image_load(SceneImage* im) {
+    ImageHeader* hd = im->hd;
+
+    Scene s = scene_new(hd->camera);
+    s.strategy = (BVHStrategy) hd->strategy;
+    s.accel = (Accelerator) hd->accel;
+    s.batch_spheres = hd->batch_spheres;
+
+    Material** materials = malloc(MAX(1, hd->mc) * sizeof *materials);
+
+    size_t i;
+    for(i = hd->mc; i-- > 0;) materials[i] = scene_add_material(&s, im->materials[i]);
+    for(i = hd->lc; i-- > 0;) scene_add_light(&s, im->lights[i]);
+
+    for(i = hd->sc; i-- > 0;) {
+        ImageSphere* is = &im->spheres[i];
+
+        scene_add_sphere(&s, (Sphere) {
+            .center = is->center,
+            .radius = is->radius,
+            .material = materials[is->material]
+        }, (is->dynamic) ? DYNAMIC : STATIC);
+    }
+
+    // Tris are stored mesh after mesh, so the last mesh's start at the end
+    size_t end = hd->tc;
+    for(i = hd->hc; i-- > 0;) {
+        ImageMesh* ih = &im->meshes[i];
+
+        Mesh m = (Mesh) { .tc = ih->tc, .tris = malloc(MAX(1, ih->tc) * sizeof *m.tris) };
+
+        end -= ih->tc;
+
+        size_t k;
+        for(k = 0; k < m.tc; k++) {
+            ImageTri* it = &im->tris[end + k];
+
+            m.tris[k] = tri_new(it->a, it->b, it->c, materials[it->material]);
+        }
+
+        scene_add_mesh(&s, m, (ih->dynamic) ? DYNAMIC : STATIC);
+    }
+
+    free(materials);
+
+    scene_initialize(&s);
+
+    if(hd->track_dynamic) scene_track_dynamic(&s);
+    if(hd->bits) scene_compress(&s, hd->bits);
+
+    return s;
+}
+
+void scene_image_close(SceneImage* im) {
+    if(!im) return;
+
+    munmap(im->hd, im->len);
+    free(im);
+}
+
+#endif /* IMAGE_H */
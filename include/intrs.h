@@ -37,13 +37,14 @@ SLL* sll_insert(SLL* head, void* item) {
 //
 // `Surface` declaration
 
-typedef enum SurfaceType { NONE = 0, TRI, SPHERE } SurfaceType;
+typedef enum SurfaceType { NONE = 0, TRI, SPHERE, BATCH } SurfaceType;
 
 typedef struct Surface {
     SurfaceType st;
     union {
         Tri* tri;
         Sphere* sphere;
+        SphereBatch* batch;
     };
 } Surface;
 
@@ -56,6 +57,8 @@ int surface_match(Surface a, Surface b) {
             return b.st == SPHERE && a.sphere == b.sphere;
         case TRI:
             return b.st == TRI && a.tri == b.tri;
+        case BATCH:
+            return b.st == BATCH && a.batch == b.batch;
         case NONE:
             return b.st == NONE;
     }
@@ -63,6 +66,38 @@ int surface_match(Surface a, Surface b) {
     return 0;
 }
 
+// Returns `t_max + 1.` on a miss, like the primitive intersection functions
+double surface_intersection(Surface s, Ray r, double t_min, double t_max) {
+    switch(s.st) {
+        case TRI: return tri_intersection(*s.tri, r, t_min, t_max);
+        case SPHERE: return sphere_intersection(*s.sphere, r, t_min, t_max);
+        case BATCH: {
+            double t;
+            sphere_batch_intersection(s.batch, r, NULL, t_min, t_max, &t);
+
+            return t;
+        }
+        case NONE: break;
+    }
+
+    return t_max + 1.;
+}
+
+// Returns a miss when `s` is `e`, the surface hit is written to `hit`
+// For a batch that is the `Sphere` that was hit, `e` may also be one of its spheres
+double surface_intersection_excl(Surface s, Ray r, Surface e, double t_min, double t_max, Surface* hit) {
+    *hit = s;
+
+    if(s.st != BATCH) return (surface_match(e, s)) ? t_max + 1. : surface_intersection(s, r, t_min, t_max);
+
+    double t;
+    size_t i = sphere_batch_intersection(s.batch, r, (e.st == SPHERE) ? e.sphere : NULL, t_min, t_max, &t);
+
+    if(i < s.batch->count) *hit = (Surface) { .st = SPHERE, .sphere = s.batch->spheres[i] };
+
+    return t;
+}
+
 void surface_print_internal(Surface* s, char* name, size_t indent) {
     int id = 4 * (int) indent;
 
@@ -78,6 +113,9 @@ void surface_print_internal(Surface* s, char* name, size_t indent) {
         case SPHERE:
             sphere_print_internal(s->sphere, NULL, indent + 1);
             break;
+        case BATCH:
+            printf("%.*s`BATCH` of %u spheres\n", id + 4, PADDING, (unsigned) s->batch->count);
+            break;
         case NONE: 
             printf("%.*s`NONE`\n", id + 4, PADDING);
     } printf("%.*s}\n", id, PADDING);
@@ -113,38 +151,67 @@ void helper_bvh_push_extrema(Vec a, Vec* minima, Vec* maxima) {
     if(a.z > maxima->z) maxima->z = a.z;
 }
 
+// Grows `minima` and `maxima` to enclose the given `Surface`
+void helper_bvh_surface_extrema(Surface s, Vec* minima, Vec* maxima) {
+    switch(s.st) {
+        case TRI: {
+            helper_bvh_push_extrema(s.tri->a.point, minima, maxima);
+            helper_bvh_push_extrema(s.tri->b.point, minima, maxima);
+            helper_bvh_push_extrema(s.tri->c.point, minima, maxima);
+        }; break;
+        case SPHERE: {
+            Vec a = vec_aaa(s.sphere->radius);
+
+            Vec mn = sub_vv(s.sphere->center, a);
+            Vec mx = add_vv(s.sphere->center, a);
+
+            helper_bvh_push_extrema(mn, minima, maxima);
+            helper_bvh_push_extrema(mx, minima, maxima);
+        }; break;
+        case BATCH: {
+            size_t i;
+            for(i = 0; i < s.batch->count; i++)
+                helper_bvh_surface_extrema((Surface) { .st = SPHERE, .sphere = s.batch->spheres[i] }, minima, maxima);
+        }; break;
+        case NONE: break;
+    }
+}
+
 void helper_bvh_extrema(SLL* surfaces, Vec* minima, Vec* maxima) {
     *minima = vec_aaa(DBL_MAX);
     *maxima = vec_aaa(-1. * DBL_MAX);
 
     SLL* curr;
-    for(curr = surfaces; curr; curr = curr->next) {
-        Surface s = *(Surface*) curr->item;
-
-        switch(s.st) {
-            case TRI: {
-                helper_bvh_push_extrema(s.tri->a.point, minima, maxima);
-                helper_bvh_push_extrema(s.tri->b.point, minima, maxima);
-                helper_bvh_push_extrema(s.tri->c.point, minima, maxima);
-            }; break;
-            case SPHERE: {
-                Vec a = vec_aaa(s.sphere->radius);
-
-                Vec mn = sub_vv(s.sphere->center, a);
-                Vec mx = add_vv(s.sphere->center, a);
-
-                helper_bvh_push_extrema(mn, minima, maxima);
-                helper_bvh_push_extrema(mx, minima, maxima);
-            }; break;
-            case NONE: continue;
-        }
-    }
+    for(curr = surfaces; curr; curr = curr->next)
+        helper_bvh_surface_extrema(*(Surface*) curr->item, minima, maxima);
 }
 
+// Surface area of the box spanned by `minima` and `maxima`, 0 if it is empty
+double helper_bvh_area(Vec minima, Vec maxima) {
+    Vec d = sub_vv(maxima, minima);
+    if(d.x < 0. || d.y < 0. || d.z < 0.) return 0.;
+
+    return 2. * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+//
+// `BVHStrategy` declaration
+
+// MIDPOINT halves the longest axis of each node (see `bvh_split`),
+// SAH picks the binned split with the lowest surface area heuristic cost
+typedef enum BVHStrategy { MIDPOINT = 0, SAH, SBVH } BVHStrategy;
+
 // Forward definition of the hierarchy split functionality
 void bvh_split(BVH* h);
+BVH* bvh_build_sah(size_t sc, Surface* surfaces);
+BVH* bvh_build_sbvh(size_t sc, Surface* surfaces, double growth);
+
+#define SBVH_GROWTH 1.5
+
+BVH* bvh_initialize_strategy(size_t sc, Surface* surfaces, BVHStrategy bs) {
+    if(bs == SAH) return bvh_build_sah(sc, surfaces);
+    if(bs == SBVH) return bvh_build_sbvh(sc, surfaces, SBVH_GROWTH);
 
-BVH* bvh_initialize(size_t sc, Surface* surfaces) {
     SLL* head = NULL;
     
     size_t i;
@@ -167,6 +234,10 @@ BVH* bvh_initialize(size_t sc, Surface* surfaces) {
     return h;
 }
 
+BVH* bvh_initialize(size_t sc, Surface* surfaces) {
+    return bvh_initialize_strategy(sc, surfaces, MIDPOINT);
+}
+
 void bvh_free(BVH* h) {
     if(!h) return;
     
@@ -184,6 +255,29 @@ void bvh_free(BVH* h) {
     free(h);
 }
 
+// Recomputes every bound bottom-up after surfaces moved, keeping the topology
+void bvh_refit(BVH* h) {
+    if(!h->l && !h->r) {
+        helper_bvh_extrema(h->surfaces, &h->minima, &h->maxima);
+        return;
+    }
+
+    h->minima = vec_aaa(DBL_MAX);
+    h->maxima = vec_aaa(-1. * DBL_MAX);
+
+    BVH* children[2] = { h->l, h->r };
+
+    size_t i;
+    for(i = 0; i < 2; i++) {
+        if(!children[i]) continue;
+
+        bvh_refit(children[i]);
+
+        helper_bvh_push_extrema(children[i]->minima, &h->minima, &h->maxima);
+        helper_bvh_push_extrema(children[i]->maxima, &h->minima, &h->maxima);
+    }
+}
+
 //
 // Helper functions
 
@@ -204,6 +298,14 @@ int helper_bvh_contains(Vec minima, Vec maxima, Surface s) {
             return helper_bvh_contains_point(minima, maxima, s.tri->centroid);
         case SPHERE:
             return helper_bvh_contains_point(minima, maxima, s.sphere->center);
+        case BATCH: {
+            Vec mn = vec_aaa(DBL_MAX);
+            Vec mx = vec_aaa(-1. * DBL_MAX);
+
+            helper_bvh_surface_extrema(s, &mn, &mx);
+
+            return helper_bvh_contains_point(minima, maxima, mul_vs(add_vv(mn, mx), 0.5));
+        }
         case NONE: return 0;
     }
 
@@ -232,32 +334,41 @@ int helper_bvh_scale_check(double d, BVH* l, BVH* r) {
     return 0;
 }
 
-int helper_bvh_ray_collides(BVH* h, Ray r) {
+// Distance along `r` at which it enters the box, or DBL_MAX if it misses
+double helper_bvh_box_entry(Vec minima, Vec maxima, Ray r) {
     r.dir = inv_v(r.dir);
 
     double t_min = 0.0;
     double t_max = DBL_MAX;
     
     double t0, t1;
-    t0 = (h->minima.x - EPS_BVH - r.origin.x) * r.dir.x;
-    t1 = (h->maxima.x + EPS_BVH - r.origin.x) * r.dir.x;
+    t0 = (minima.x - EPS_BVH - r.origin.x) * r.dir.x;
+    t1 = (maxima.x + EPS_BVH - r.origin.x) * r.dir.x;
 
     t_min = MAX(t_min, MIN(t0, t1));
     t_max = MIN(t_max, MAX(t0, t1)); 
 
-    t0 = (h->minima.y - EPS_BVH - r.origin.y) * r.dir.y;
-    t1 = (h->maxima.y + EPS_BVH - r.origin.y) * r.dir.y;
+    t0 = (minima.y - EPS_BVH - r.origin.y) * r.dir.y;
+    t1 = (maxima.y + EPS_BVH - r.origin.y) * r.dir.y;
 
     t_min = MAX(t_min, MIN(t0, t1));
     t_max = MIN(t_max, MAX(t0, t1)); 
 
-    t0 = (h->minima.z - EPS_BVH - r.origin.z) * r.dir.z;
-    t1 = (h->maxima.z + EPS_BVH - r.origin.z) * r.dir.z;
+    t0 = (minima.z - EPS_BVH - r.origin.z) * r.dir.z;
+    t1 = (maxima.z + EPS_BVH - r.origin.z) * r.dir.z;
 
     t_min = MAX(t_min, MIN(t0, t1));
     t_max = MIN(t_max, MAX(t0, t1)); 
 
-    return t_min < t_max;
+    return (t_min < t_max) ? t_min : DBL_MAX;
+}
+
+int helper_bvh_box_collides(Vec minima, Vec maxima, Ray r) {
+    return helper_bvh_box_entry(minima, maxima, r) < DBL_MAX;
+}
+
+int helper_bvh_ray_collides(BVH* h, Ray r) {
+    return helper_bvh_box_collides(h->minima, h->maxima, r);
 }
 
 //
@@ -351,6 +462,523 @@ void bvh_split(BVH* h) {
     }
 }
 
+//
+// `BVH` surface area heuristic construction
+
+#define SAH_BINS 12
+#define SAH_LEAF 8
+#define SAH_TRAVERSAL 1.
+#define SAH_INTERSECT 1.
+
+typedef struct BVHRef {
+    Surface* s;
+    Vec minima;
+    Vec maxima;
+    Vec centroid;
+} BVHRef;
+
+typedef struct BVHBin {
+    size_t count;
+    Vec minima;
+    Vec maxima;
+} BVHBin;
+
+double helper_vec_axis(Vec v, Axis axis) {
+    switch(axis) {
+        case X: return v.x;
+        case Y: return v.y;
+        case Z: return v.z;
+    }
+
+    return 0.;
+}
+
+BVH* helper_bvh_leaf(BVHRef* refs, size_t rc, Vec minima, Vec maxima) {
+    BVH* h = malloc(sizeof *h);
+    *h = (BVH) {
+        .l = NULL,
+        .r = NULL,
+        .minima = minima,
+        .maxima = maxima,
+        .surfaces = NULL
+    };
+
+    size_t i;
+    for(i = rc; i > 0; i--) h->surfaces = sll_insert(h->surfaces, refs[i - 1].s);
+
+    return h;
+}
+
+size_t helper_bvh_bin(BVHRef* ref, Axis axis, double lo, double extent) {
+    double k = (helper_vec_axis(ref->centroid, axis) - lo) / extent;
+
+    size_t b = (size_t) (k * (double) SAH_BINS);
+
+    return MIN(b, SAH_BINS - 1);
+}
+
+// Finds the cheapest binned split over all three axes
+// Returns the SAH cost of that split, or DBL_MAX if the centroids coincide
+double helper_bvh_sah_split(BVHRef* refs, size_t rc, 
+    Vec c_min, Vec c_max, double area, Axis* axis, size_t* split) {
+
+    double best = DBL_MAX;
+
+    Axis a;
+    for(a = X; a <= Z; a++) {
+        double lo = helper_vec_axis(c_min, a);
+        double extent = helper_vec_axis(c_max, a) - lo;
+        if(extent <= 0.) continue;
+
+        BVHBin bins[SAH_BINS];
+
+        size_t i;
+        for(i = 0; i < SAH_BINS; i++) bins[i] = (BVHBin) {
+            .count = 0,
+            .minima = vec_aaa(DBL_MAX),
+            .maxima = vec_aaa(-1. * DBL_MAX)
+        };
+
+        for(i = 0; i < rc; i++) {
+            BVHBin* bin = &bins[helper_bvh_bin(&refs[i], a, lo, extent)];
+
+            bin->count++;
+            helper_bvh_push_extrema(refs[i].minima, &bin->minima, &bin->maxima);
+            helper_bvh_push_extrema(refs[i].maxima, &bin->minima, &bin->maxima);
+        }
+
+        // Sweep from the right to accumulate the area of each right partition
+        double r_area[SAH_BINS];
+        size_t r_count[SAH_BINS];
+
+        Vec mn = vec_aaa(DBL_MAX);
+        Vec mx = vec_aaa(-1. * DBL_MAX);
+
+        size_t count = 0;
+        for(i = SAH_BINS - 1; i > 0; i--) {
+            if(bins[i].count) {
+                count += bins[i].count;
+                helper_bvh_push_extrema(bins[i].minima, &mn, &mx);
+                helper_bvh_push_extrema(bins[i].maxima, &mn, &mx);
+            }
+
+            r_area[i] = helper_bvh_area(mn, mx);
+            r_count[i] = count;
+        }
+
+        mn = vec_aaa(DBL_MAX);
+        mx = vec_aaa(-1. * DBL_MAX);
+
+        count = 0;
+        for(i = 1; i < SAH_BINS; i++) {
+            if(bins[i - 1].count) {
+                count += bins[i - 1].count;
+                helper_bvh_push_extrema(bins[i - 1].minima, &mn, &mx);
+                helper_bvh_push_extrema(bins[i - 1].maxima, &mn, &mx);
+            }
+
+            if(!count || !r_count[i]) continue;
+
+            double cost = SAH_TRAVERSAL + SAH_INTERSECT * (
+                helper_bvh_area(mn, mx) * (double) count + 
+                r_area[i] * (double) r_count[i]) / area;
+
+            if(cost < best) {
+                best = cost;
+                *axis = a;
+                *split = i;
+            }
+        }
+    }
+
+    return best;
+}
+
+BVH* helper_bvh_build_sah(BVHRef* refs, size_t rc) {
+    Vec minima = vec_aaa(DBL_MAX);
+    Vec maxima = vec_aaa(-1. * DBL_MAX);
+
+    Vec c_min = vec_aaa(DBL_MAX);
+    Vec c_max = vec_aaa(-1. * DBL_MAX);
+
+    size_t i;
+    for(i = 0; i < rc; i++) {
+        helper_bvh_push_extrema(refs[i].minima, &minima, &maxima);
+        helper_bvh_push_extrema(refs[i].maxima, &minima, &maxima);
+        helper_bvh_push_extrema(refs[i].centroid, &c_min, &c_max);
+    }
+
+    if(rc == 1) return helper_bvh_leaf(refs, rc, minima, maxima);
+
+    Axis axis = X;
+    size_t split = 0;
+
+    double area = helper_bvh_area(minima, maxima);
+    double cost = helper_bvh_sah_split(refs, rc, c_min, c_max, area, &axis, &split);
+
+    // Leaves are only kept when splitting is no cheaper, or impossible
+    if(cost == DBL_MAX || (cost >= SAH_INTERSECT * (double) rc && rc <= SAH_LEAF))
+        return helper_bvh_leaf(refs, rc, minima, maxima);
+
+    double lo = helper_vec_axis(c_min, axis);
+    double extent = helper_vec_axis(c_max, axis) - lo;
+
+    size_t mid = 0;
+    for(i = 0; i < rc; i++) {
+        if(helper_bvh_bin(&refs[i], axis, lo, extent) < split) {
+            BVHRef temp = refs[mid];
+            refs[mid++] = refs[i];
+            refs[i] = temp;
+        }
+    }
+
+    BVH* h = malloc(sizeof *h);
+    *h = (BVH) {
+        .l = helper_bvh_build_sah(refs, mid),
+        .r = helper_bvh_build_sah(refs + mid, rc - mid),
+        .minima = minima,
+        .maxima = maxima,
+        .surfaces = NULL
+    };
+
+    return h;
+}
+
+BVH* bvh_build_sah(size_t sc, Surface* surfaces) {
+    assert(sc && "Error: Unable to build a BVH without surfaces");
+
+    BVHRef* refs = malloc(sc * sizeof *refs);
+
+    size_t i;
+    for(i = 0; i < sc; i++) {
+        BVHRef* ref = &refs[i];
+
+        ref->s = &surfaces[i];
+        ref->minima = vec_aaa(DBL_MAX);
+        ref->maxima = vec_aaa(-1. * DBL_MAX);
+
+        helper_bvh_surface_extrema(surfaces[i], &ref->minima, &ref->maxima);
+
+        ref->centroid = mul_vs(add_vv(ref->minima, ref->maxima), 0.5);
+    }
+
+    BVH* h = helper_bvh_build_sah(refs, sc);
+
+    free(refs);
+
+    return h;
+}
+
+//
+// `BVH` spatial split construction (SBVH)
+
+// Besides the binned object split, every node also considers splitting space into
+// `SAH_BINS` slabs, clipping references that straddle the chosen plane into one per side
+// References duplicated this way may not grow past `growth` times the surface count
+
+#define SBVH_DEPTH 64
+
+typedef struct SBVHBin {
+    size_t entries;
+    size_t exits;
+    Vec minima;
+    Vec maxima;
+} SBVHBin;
+
+void helper_vec_set_axis(Vec* v, Axis axis, double d) {
+    switch(axis) {
+        case X: v->x = d; break;
+        case Y: v->y = d; break;
+        case Z: v->z = d; break;
+    }
+}
+
+// Bounds of the part of `ref` between `lo` and `hi` along `axis`, returns 0 if it is empty
+// Triangles are clipped exactly, other surfaces just have their box cut to the slab
+int helper_sbvh_clip(BVHRef* ref, Axis axis, double lo, double hi, Vec* minima, Vec* maxima) {
+    *minima = vec_aaa(DBL_MAX);
+    *maxima = vec_aaa(-1. * DBL_MAX);
+
+    if(ref->s->st == TRI) {
+        Tri* t = ref->s->tri;
+        Vec ps[3] = { t->a.point, t->b.point, t->c.point };
+
+        size_t i;
+        for(i = 0; i < 3; i++) {
+            Vec a = ps[i];
+            Vec b = ps[(i + 1) % 3];
+
+            double da = helper_vec_axis(a, axis);
+            double db = helper_vec_axis(b, axis);
+
+            if(da >= lo && da <= hi) helper_bvh_push_extrema(a, minima, maxima);
+
+            // Points where the edge crosses either plane of the slab
+            double planes[2] = { lo, hi };
+
+            size_t j;
+            for(j = 0; j < 2; j++) {
+                double p = planes[j];
+                if((da < p && db > p) || (da > p && db < p)) {
+                    Vec x = add_vv(a, mul_vs(sub_vv(b, a), (p - da) / (db - da)));
+                    helper_vec_set_axis(&x, axis, p);
+
+                    helper_bvh_push_extrema(x, minima, maxima);
+                }
+            }
+        }
+    } else {
+        *minima = ref->minima;
+        *maxima = ref->maxima;
+
+        helper_vec_set_axis(minima, axis, MAX(lo, helper_vec_axis(*minima, axis)));
+        helper_vec_set_axis(maxima, axis, MIN(hi, helper_vec_axis(*maxima, axis)));
+    }
+
+    // Stay within the reference, which may have been clipped on other axes already
+    *minima = (Vec) { MAX(minima->x, ref->minima.x), MAX(minima->y, ref->minima.y), MAX(minima->z, ref->minima.z) };
+    *maxima = (Vec) { MIN(maxima->x, ref->maxima.x), MIN(maxima->y, ref->maxima.y), MIN(maxima->z, ref->maxima.z) };
+
+    return minima->x <= maxima->x && minima->y <= maxima->y && minima->z <= maxima->z;
+}
+
+size_t helper_sbvh_bin(double v, double lo, double extent) {
+    double k = (v - lo) / extent;
+
+    return MIN((size_t) MAX(0., k * (double) SAH_BINS), SAH_BINS - 1);
+}
+
+// Finds the cheapest spatial split over all three axes that fits in `budget` duplicates
+// Returns its SAH cost, or DBL_MAX if there is none
+double helper_sbvh_spatial_split(BVHRef* refs, size_t rc, Vec minima, Vec maxima, 
+    double area, size_t budget, Axis* axis, double* plane) {
+
+    double best = DBL_MAX;
+
+    Axis a;
+    for(a = X; a <= Z; a++) {
+        double lo = helper_vec_axis(minima, a);
+        double extent = helper_vec_axis(maxima, a) - lo;
+        if(extent <= 0.) continue;
+
+        double width = extent / (double) SAH_BINS;
+
+        SBVHBin bins[SAH_BINS];
+
+        size_t i;
+        for(i = 0; i < SAH_BINS; i++) bins[i] = (SBVHBin) {
+            .entries = 0,
+            .exits = 0,
+            .minima = vec_aaa(DBL_MAX),
+            .maxima = vec_aaa(-1. * DBL_MAX)
+        };
+
+        for(i = 0; i < rc; i++) {
+            size_t b0 = helper_sbvh_bin(helper_vec_axis(refs[i].minima, a), lo, extent);
+            size_t b1 = helper_sbvh_bin(helper_vec_axis(refs[i].maxima, a), lo, extent);
+
+            size_t b;
+            for(b = b0; b <= b1; b++) {
+                Vec mn, mx;
+
+                double s_lo = (b == 0) ? -1. * DBL_MAX : lo + width * (double) b;
+                double s_hi = (b == SAH_BINS - 1) ? DBL_MAX : lo + width * (double) (b + 1);
+
+                if(!helper_sbvh_clip(&refs[i], a, s_lo, s_hi, &mn, &mx)) continue;
+
+                helper_bvh_push_extrema(mn, &bins[b].minima, &bins[b].maxima);
+                helper_bvh_push_extrema(mx, &bins[b].minima, &bins[b].maxima);
+            }
+
+            bins[b0].entries++;
+            bins[b1].exits++;
+        }
+
+        double r_area[SAH_BINS];
+        size_t r_count[SAH_BINS];
+
+        Vec mn = vec_aaa(DBL_MAX);
+        Vec mx = vec_aaa(-1. * DBL_MAX);
+
+        size_t count = 0;
+        for(i = SAH_BINS - 1; i > 0; i--) {
+            count += bins[i].exits;
+
+            if(bins[i].minima.x <= bins[i].maxima.x) {
+                helper_bvh_push_extrema(bins[i].minima, &mn, &mx);
+                helper_bvh_push_extrema(bins[i].maxima, &mn, &mx);
+            }
+
+            r_area[i] = helper_bvh_area(mn, mx);
+            r_count[i] = count;
+        }
+
+        mn = vec_aaa(DBL_MAX);
+        mx = vec_aaa(-1. * DBL_MAX);
+
+        count = 0;
+        for(i = 1; i < SAH_BINS; i++) {
+            count += bins[i - 1].entries;
+
+            if(bins[i - 1].minima.x <= bins[i - 1].maxima.x) {
+                helper_bvh_push_extrema(bins[i - 1].minima, &mn, &mx);
+                helper_bvh_push_extrema(bins[i - 1].maxima, &mn, &mx);
+            }
+
+            if(!count || !r_count[i] || count + r_count[i] - rc > budget) continue;
+
+            // A split that duplicates everything cannot make progress
+            if(count == rc && r_count[i] == rc) continue;
+
+            double cost = SAH_TRAVERSAL + SAH_INTERSECT * (
+                helper_bvh_area(mn, mx) * (double) count + 
+                r_area[i] * (double) r_count[i]) / area;
+
+            if(cost < best) {
+                best = cost;
+                *axis = a;
+                *plane = lo + width * (double) i;
+            }
+        }
+    }
+
+    return best;
+}
+
+void helper_sbvh_push(BVHRef** refs, size_t* rc, size_t* cap, BVHRef ref) {
+    if(*rc == *cap) {
+        *cap = MAX(16, 2 * *cap);
+        *refs = realloc(*refs, *cap * sizeof **refs);
+    }
+
+    ref.centroid = mul_vs(add_vv(ref.minima, ref.maxima), 0.5);
+
+    (*refs)[(*rc)++] = ref;
+}
+
+BVH* helper_bvh_build_sbvh(BVHRef* refs, size_t rc, size_t* budget, size_t depth) {
+    Vec minima = vec_aaa(DBL_MAX);
+    Vec maxima = vec_aaa(-1. * DBL_MAX);
+
+    Vec c_min = vec_aaa(DBL_MAX);
+    Vec c_max = vec_aaa(-1. * DBL_MAX);
+
+    size_t i;
+    for(i = 0; i < rc; i++) {
+        helper_bvh_push_extrema(refs[i].minima, &minima, &maxima);
+        helper_bvh_push_extrema(refs[i].maxima, &minima, &maxima);
+        helper_bvh_push_extrema(refs[i].centroid, &c_min, &c_max);
+    }
+
+    if(rc == 1 || depth >= SBVH_DEPTH) return helper_bvh_leaf(refs, rc, minima, maxima);
+
+    Axis axis = X, s_axis = X;
+    size_t split = 0;
+    double plane = 0.;
+
+    double area = helper_bvh_area(minima, maxima);
+    double cost = helper_bvh_sah_split(refs, rc, c_min, c_max, area, &axis, &split);
+    double s_cost = helper_sbvh_spatial_split(refs, rc, minima, maxima, area, *budget, &s_axis, &plane);
+
+    double leaf = SAH_INTERSECT * (double) rc;
+    if(MIN(cost, s_cost) == DBL_MAX || (MIN(cost, s_cost) >= leaf && rc <= SAH_LEAF))
+        return helper_bvh_leaf(refs, rc, minima, maxima);
+
+    BVHRef* l = NULL;
+    BVHRef* r = NULL;
+    size_t lc = 0, l_cap = 0, r_c = 0, r_cap = 0;
+
+    if(s_cost < cost) {
+        for(i = 0; i < rc; i++) {
+            double lo = helper_vec_axis(refs[i].minima, s_axis);
+            double hi = helper_vec_axis(refs[i].maxima, s_axis);
+
+            if(hi <= plane) helper_sbvh_push(&l, &lc, &l_cap, refs[i]);
+            else if(lo >= plane) helper_sbvh_push(&r, &r_c, &r_cap, refs[i]);
+            else {
+                BVHRef half = refs[i];
+                int sides = 0;
+
+                if(helper_sbvh_clip(&refs[i], s_axis, -1. * DBL_MAX, plane, &half.minima, &half.maxima)) {
+                    helper_sbvh_push(&l, &lc, &l_cap, half);
+                    sides++;
+                }
+
+                half = refs[i];
+                if(helper_sbvh_clip(&refs[i], s_axis, plane, DBL_MAX, &half.minima, &half.maxima)) {
+                    helper_sbvh_push(&r, &r_c, &r_cap, half);
+                    sides++;
+                }
+
+                if(sides == 2 && *budget) (*budget)--;
+            }
+        }
+    } else {
+        double lo = helper_vec_axis(c_min, axis);
+        double extent = helper_vec_axis(c_max, axis) - lo;
+
+        for(i = 0; i < rc; i++) {
+            if(helper_bvh_bin(&refs[i], axis, lo, extent) < split) 
+                helper_sbvh_push(&l, &lc, &l_cap, refs[i]);
+            else 
+                helper_sbvh_push(&r, &r_c, &r_cap, refs[i]);
+        }
+    }
+
+    // Clipping can leave a side empty, in which case there is nothing to split
+    if(!lc || !r_c) {
+        free(l);
+        free(r);
+
+        return helper_bvh_leaf(refs, rc, minima, maxima);
+    }
+
+    BVH* h = malloc(sizeof *h);
+    *h = (BVH) {
+        .l = helper_bvh_build_sbvh(l, lc, budget, depth + 1),
+        .r = NULL,
+        .minima = minima,
+        .maxima = maxima,
+        .surfaces = NULL
+    };
+
+    free(l);
+
+    h->r = helper_bvh_build_sbvh(r, r_c, budget, depth + 1);
+
+    free(r);
+
+    return h;
+}
+
+// Leaves may share surfaces, each leaf's box only covers its own part of them
+BVH* bvh_build_sbvh(size_t sc, Surface* surfaces, double growth) {
+    assert(sc && "Error: Unable to build a BVH without surfaces");
+
+    BVHRef* refs = malloc(sc * sizeof *refs);
+
+    size_t i;
+    for(i = 0; i < sc; i++) {
+        BVHRef* ref = &refs[i];
+
+        ref->s = &surfaces[i];
+        ref->minima = vec_aaa(DBL_MAX);
+        ref->maxima = vec_aaa(-1. * DBL_MAX);
+
+        helper_bvh_surface_extrema(surfaces[i], &ref->minima, &ref->maxima);
+
+        ref->centroid = mul_vs(add_vv(ref->minima, ref->maxima), 0.5);
+    }
+
+    size_t budget = (size_t) ((double) sc * MAX(0., growth - 1.));
+
+    BVH* h = helper_bvh_build_sbvh(refs, sc, &budget, 0);
+
+    free(refs);
+
+    return h;
+}
+
 //
 // `Intersection` declaration
 
@@ -369,6 +997,9 @@ void intersection_print(Intersection* i) {
         case TRI:
             tri_print_internal(i->s.tri, NULL, 1);
             break;
+        case BATCH:
+            printf("    `BATCH`\n");
+            break;
         case NONE: 
             printf("    `NONE`\n");
     }; printf("    t: %lf\n}\n", i->t);
@@ -419,6 +1050,7 @@ void intersection_normal(Intersection i, Ray r, Vec* normal, Vec* hit) {
         case TRI: 
             *normal = helper_intersection_tri_normal(*i.s.tri, *hit);
             break;
+        case BATCH:
         case NONE:
             assert(0);
     }
@@ -435,6 +1067,7 @@ Material* intersection_material(Intersection i) {
         case TRI:
             material = i.s.tri->material;
             break;
+        case BATCH:
         case NONE:
             assert(0);
     }
@@ -442,32 +1075,22 @@ Material* intersection_material(Intersection i) {
     return material;
 }
 
-Intersection helper_bvh_intersection(BVH* h, Ray r, Surface e, double t_min, double t_max) {
+// Expects the ray to enter `h` before `t_max`
+// The nearer child is visited first, and a child entered beyond the closest hit is skipped
+Intersection helper_bvh_intersection_entered(BVH* h, Ray r, Surface e, double t_min, double t_max) {
     Intersection intrs_a, intrs_b;
     intrs_a = (Intersection) {
         .s = (Surface) { .st = NONE },
         .t = t_max + 1.
     };
 
-    if(!helper_bvh_ray_collides(h, r)) return intrs_a;
-
     if(!h->l && !h->r) {
         SLL* curr;
         for(curr = h->surfaces; curr; curr = curr->next) {
-            Surface s = *(Surface*) curr->item;
-
-            double t;
-            switch(s.st) {
-                case TRI:
-                    t = tri_intersection(*s.tri, r, t_min, t_max);
-                    break;
-                case SPHERE:
-                    t = sphere_intersection(*s.sphere, r, t_min, t_max);
-                    break;
-                case NONE: continue;
-            }
+            Surface s;
+            double t = surface_intersection_excl(*(Surface*) curr->item, r, e, t_min, t_max, &s);
 
-            if(t < intrs_a.t && !surface_match(e, s)) {
+            if(t < intrs_a.t) {
                 intrs_a.s = s;
                 intrs_a.t = t;
             }
@@ -476,10 +1099,41 @@ Intersection helper_bvh_intersection(BVH* h, Ray r, Surface e, double t_min, dou
         return intrs_a;
     }
 
-    intrs_a = helper_bvh_intersection(h->l, r, e, t_min, t_max);
-    intrs_b = helper_bvh_intersection(h->r, r, e, t_min, t_max);
+    BVH* near = h->l;
+    BVH* far = h->r;
+
+    double near_t = helper_bvh_box_entry(near->minima, near->maxima, r);
+    double far_t = helper_bvh_box_entry(far->minima, far->maxima, r);
+
+    if(far_t < near_t) {
+        BVH* temp = near;
+        near = far;
+        far = temp;
+
+        double temp_t = near_t;
+        near_t = far_t;
+        far_t = temp_t;
+    }
+
+    intrs_b = intrs_a;
+
+    if(near_t <= t_max) intrs_a = helper_bvh_intersection_entered(near, r, e, t_min, t_max);
+
+    t_max = MIN(t_max, intrs_a.t);
+    if(far_t <= t_max) intrs_b = helper_bvh_intersection_entered(far, r, e, t_min, t_max);
 
     return (intrs_a.t < intrs_b.t) ? intrs_a : intrs_b;
 }
 
+Intersection helper_bvh_intersection(BVH* h, Ray r, Surface e, double t_min, double t_max) {
+    if(helper_bvh_box_entry(h->minima, h->maxima, r) > t_max) {
+        return (Intersection) {
+            .s = (Surface) { .st = NONE },
+            .t = t_max + 1.
+        };
+    }
+
+    return helper_bvh_intersection_entered(h, r, e, t_min, t_max);
+}
+
 #endif /* INTRS_H */
\ No newline at end of file
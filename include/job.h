@@ -0,0 +1,277 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<pthread.h>
+
+#include "rt.h"
+#include "pool.h"
+
+#define JOB_MAGIC 0x4b504b43u
+#define JOB_VERSION 1
+
+//
+// `Job` declaration, a render running in the background that can be stopped and resumed
+
+// `done` holds a flag per `Block`, set once its pixels are in the `Buffer`. `next` hands
+// out `Block`s in row order, skipping done ones, and is reset each time the job starts
+// The `Scene` and the `Buffer` must outlive the job
+typedef struct Job {
+    Buffer b;
+    Scene s;
+    Config c;
+    size_t block_w;
+    size_t block_h;
+    size_t bc;
+    unsigned char* done;
+    size_t next;
+    size_t completed;
+    int cancelled;
+    int running;
+    pthread_t thread;
+} Job;
+
+// Written ahead of the done flags and the image rows in a checkpoint file
+typedef struct JobCheckpoint {
+    unsigned magic;
+    unsigned version;
+    unsigned long w;
+    unsigned long h;
+    unsigned long block_size;
+    Camera camera;
+} JobCheckpoint;
+
+// Creates a job rendering `s` into `b`, which is not started until `job_start`
+Job* job_new(Buffer b, Scene s, Config c) {
+    assert(s.tt && "Error: Scene was not initialized");
+    assert((b.w % c.block_size == 0 && b.h % c.block_size == 0) &&
+        "Error: Image dimensions must be cleanly divisible by block size");
+
+    Job* j = malloc(sizeof *j);
+
+    j->b = b;
+    j->s = s;
+    j->c = c;
+    j->block_w = b.w / c.block_size;
+    j->block_h = b.h / c.block_size;
+    j->bc = j->block_w * j->block_h;
+    j->done = calloc(j->bc, sizeof *(j->done));
+    j->next = 0;
+    j->completed = 0;
+    j->cancelled = 0;
+    j->running = 0;
+
+    return j;
+}
+
+//
+// Helper functions
+
+// Body of the job's thread, `Block`s are traced by an OpenMP team started from it
+// The cancel flag is checked before every `Block`, so a cancelled job stops as soon as
+// the `Block`s already in flight are finished
+void* helper_job_run(void* data) {
+    Job* j = (Job*) data;
+
+    Config c = j->c;
+
+    // The team starts from this thread, so it must not inherit a narrower mask than the pool's
+    if(c.pool) helper_pool_set_mask(c.pool->mask);
+
+    #pragma omp parallel num_threads(config_threads(c))
+    {
+        pool_pin_thread(c.pool);
+
+        char* tile = malloc(3 * c.block_size * c.block_size);
+
+        ShadowCache cache = shadow_cache_new();
+
+        Config tc = c;
+        tc.shadow_cache = &cache;
+
+        Scene ts = scene_local(j->s);
+
+        while(!__atomic_load_n(&j->cancelled, __ATOMIC_ACQUIRE)) {
+            size_t k = __atomic_fetch_add(&j->next, 1, __ATOMIC_ACQ_REL);
+            if(k >= j->bc) break;
+
+            if(__atomic_load_n(&j->done[k], __ATOMIC_ACQUIRE)) continue;
+
+            size_t n = k;
+            Block blk = next_block(&n, j->block_w, j->block_h, c.block_size);
+
+            helper_raytrace_block(j->b, ts, tc, blk, tile);
+
+            // Setting the flag publishes the pixels written above to `job_checkpoint`
+            __atomic_store_n(&j->done[k], 1, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&j->completed, 1, __ATOMIC_ACQ_REL);
+        }
+
+        shadow_cache_merge(&cache, c.shadow_stats);
+
+        free(tile);
+    }
+
+    return NULL;
+}
+
+//
+// Control functions
+
+// Starts, or resumes, the job in the background, tracing only the `Block`s not yet done
+// Returns 1 if it is already running or the thread could not be created
+int job_start(Job* j) {
+    if(j->running) return 1;
+
+    __atomic_store_n(&j->next, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&j->cancelled, 0, __ATOMIC_RELEASE);
+
+    if(pthread_create(&j->thread, NULL, helper_job_run, j)) return 1;
+
+    j->running = 1;
+
+    return 0;
+}
+
+// Waits for the job's thread to stop, returns 1 if any `Block` is left to trace
+int job_wait(Job* j) {
+    if(j->running) {
+        pthread_join(j->thread, NULL);
+        j->running = 0;
+    }
+
+    return __atomic_load_n(&j->completed, __ATOMIC_ACQUIRE) != j->bc;
+}
+
+// Stops the job once the `Block`s in flight are finished, which takes about the time of
+// one `Block`. Finished `Block`s are kept, so `job_start` picks up where it left off
+// Returns 1 if any `Block` is left to trace
+int job_cancel(Job* j) {
+    __atomic_store_n(&j->cancelled, 1, __ATOMIC_RELEASE);
+
+    return job_wait(j);
+}
+
+// Number of finished `Block`s, safe to poll while the job runs. `total` may be NULL
+size_t job_progress(Job* j, size_t* total) {
+    if(total) *total = j->bc;
+
+    return __atomic_load_n(&j->completed, __ATOMIC_ACQUIRE);
+}
+
+// Marks every `Block` as not done, so the next `job_start` renders a new frame
+// The job must not be running, change `j->s.camera` or the `Scene` before calling this
+void job_reset(Job* j) {
+    assert(!j->running && "Error: Job must be stopped before it is reset");
+
+    memset(j->done, 0, j->bc);
+    j->completed = 0;
+}
+
+void job_free(Job* j) {
+    if(!j) return;
+
+    job_cancel(j);
+
+    free(j->done);
+    free(j);
+}
+
+//
+// Checkpoints
+
+// Saves the finished `Block`s and the image to `file`, which may be done while the job
+// runs. Writes to a temporary file first, so an interrupted save keeps the last checkpoint
+// Returns 1 on failure
+int job_checkpoint(Job* j, char* file) {
+    // Flags are copied before the pixels, so every `Block` marked done is in the copy
+    unsigned char* done = malloc(j->bc);
+
+    size_t i;
+    for(i = 0; i < j->bc; i++) done[i] = __atomic_load_n(&j->done[i], __ATOMIC_ACQUIRE);
+
+    JobCheckpoint hd = (JobCheckpoint) {
+        .magic = JOB_MAGIC,
+        .version = JOB_VERSION,
+        .w = j->b.w,
+        .h = j->b.h,
+        .block_size = j->c.block_size,
+        .camera = j->s.camera
+    };
+
+    size_t tmp_len = strlen(file) + 5;
+    char* tmp = malloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", file);
+
+    char* row = malloc(3 * j->b.w);
+
+    int failed = 1;
+
+    FILE* f;
+    if((f = fopen(tmp, "wb"))) {
+        failed = fwrite(&hd, sizeof hd, 1, f) != 1 || fwrite(done, 1, j->bc, f) != j->bc;
+
+        size_t y;
+        for(y = 0; y < j->b.h && !failed; y++) {
+            buffer_read_row(j->b, y, row);
+            failed = fwrite(row, 1, 3 * j->b.w, f) != 3 * j->b.w;
+        }
+
+        failed |= fclose(f) != 0;
+        failed = failed || rename(tmp, file) != 0;
+
+        if(failed) remove(tmp);
+    }
+
+    free(row);
+    free(tmp);
+    free(done);
+
+    return failed;
+}
+
+// Loads a checkpoint saved by `job_checkpoint` into a stopped job, after which `job_start`
+// traces only the `Block`s it was missing. Returns 1 if the file cannot be read or was
+// saved for a different image size, `Block` size or camera
+int job_restore(Job* j, char* file) {
+    assert(!j->running && "Error: Job must be stopped before it is restored");
+
+    FILE* f;
+    if(!(f = fopen(file, "rb"))) return 1;
+
+    JobCheckpoint hd;
+
+    int failed = fread(&hd, sizeof hd, 1, f) != 1 || hd.magic != JOB_MAGIC ||
+        hd.version != JOB_VERSION || hd.w != j->b.w || hd.h != j->b.h ||
+        hd.block_size != j->c.block_size || memcmp(&hd.camera, &j->s.camera, sizeof hd.camera);
+
+    unsigned char* done = malloc(j->bc);
+
+    failed = failed || fread(done, 1, j->bc, f) != j->bc;
+
+    // Rows are only copied in once the whole file has been read, so a failed restore
+    // leaves the job as it was
+    char* rows = (failed) ? NULL : malloc(3 * j->b.w * j->b.h);
+    failed = failed || fread(rows, 1, 3 * j->b.w * j->b.h, f) != 3 * j->b.w * j->b.h;
+
+    fclose(f);
+
+    if(!failed) {
+        size_t y;
+        for(y = 0; y < j->b.h; y++) buffer_write_tile(j->b, 0, y, j->b.w, 1, rows + 3 * y * j->b.w);
+
+        size_t i, completed = 0;
+        for(i = 0; i < j->bc; i++) completed += (j->done[i] = done[i] != 0);
+
+        j->completed = completed;
+    }
+
+    free(rows);
+    free(done);
+
+    return failed;
+}
+
+#endif /* JOB_H */
@@ -186,6 +186,31 @@ double dist_vv(Vec a, Vec b) {
     return sqrt(distsq_vv(a, b));
 }
 
+//
+// Random number generation
+
+typedef struct Rng { unsigned long long state; } Rng;
+
+// Seeds are scrambled with splitmix64 so neighboring seeds diverge
+Rng rng_seed(unsigned long long seed) {
+    unsigned long long z = seed + 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+
+    return (Rng) { .state = z ? z : 1 };
+}
+
+// Returns a uniformly distributed double in [0, 1)
+double rng_next(Rng* r) {
+    r->state ^= r->state >> 12;
+    r->state ^= r->state << 25;
+    r->state ^= r->state >> 27;
+
+    return (double) ((r->state * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.;
+}
+
 //
 // Transformations
 
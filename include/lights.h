@@ -0,0 +1,254 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<float.h>
+#include<math.h>
+
+#include "geom.h"
+#include "intrs.h"
+
+#define LIGHT_GRID_MAX 64
+#define SHADOW_CACHE_SIZE 64
+
+//
+// `LightGrid` declaration, a uniform grid over the spheres of influence of bounded lights
+
+// Each cell lists the lights that can reach it, in `Scene` order
+// Unbounded lights (`radius` of 0) reach everything, so they are listed in every cell
+// and make up the whole list outside the grid
+typedef struct LightGrid {
+    Vec minima;
+    Vec maxima;
+    size_t n[3];
+    Vec cell;
+    size_t* offsets;
+    Light** items;
+    size_t uc;
+    Light** unbounded;
+} LightGrid;
+
+//
+// Helper functions
+
+size_t helper_light_grid_cell(LightGrid* g, Vec p, size_t* ix, size_t* iy, size_t* iz) {
+    *ix = (size_t) MIN((double) (g->n[0] - 1), MAX(0., (p.x - g->minima.x) / g->cell.x));
+    *iy = (size_t) MIN((double) (g->n[1] - 1), MAX(0., (p.y - g->minima.y) / g->cell.y));
+    *iz = (size_t) MIN((double) (g->n[2] - 1), MAX(0., (p.z - g->minima.z) / g->cell.z));
+
+    return *ix + g->n[0] * (*iy + g->n[1] * *iz);
+}
+
+// Adds the light to every cell overlapped by its sphere of influence
+// Passing NULL for `items` only counts, otherwise lights are written at `cursor`
+void helper_light_grid_fill(LightGrid* g, Light* l, size_t* counts, size_t* cursor, Light** items) {
+    size_t cc = g->n[0] * g->n[1] * g->n[2];
+
+    if(l->radius <= 0.) {
+        size_t i;
+        for(i = 0; i < cc; i++) {
+            if(items) items[cursor[i]++] = l;
+            else counts[i]++;
+        }
+
+        return;
+    }
+
+    size_t x0, y0, z0, x1, y1, z1;
+    helper_light_grid_cell(g, sub_vv(l->pos, vec_aaa(l->radius)), &x0, &y0, &z0);
+    helper_light_grid_cell(g, add_vv(l->pos, vec_aaa(l->radius)), &x1, &y1, &z1);
+
+    size_t x, y, z;
+    for(z = z0; z <= z1; z++)
+        for(y = y0; y <= y1; y++)
+            for(x = x0; x <= x1; x++) {
+                size_t i = x + g->n[0] * (y + g->n[1] * z);
+
+                if(items) items[cursor[i]++] = l;
+                else counts[i]++;
+            }
+}
+
+//
+// `LightGrid` functions
+
+LightGrid* light_grid_new(SLL* lights) {
+    LightGrid* g = malloc(sizeof *g);
+
+    g->minima = vec_aaa(DBL_MAX);
+    g->maxima = vec_aaa(-1. * DBL_MAX);
+    g->uc = 0;
+
+    size_t lc = 0, bc = 0;
+
+    SLL* curr;
+    for(curr = lights; curr; curr = curr->next) lc++;
+
+    Light** ls = malloc(MAX(1, lc) * sizeof *ls);
+
+    size_t i = 0;
+    for(curr = lights; curr; curr = curr->next) ls[i++] = (Light*) curr->item;
+
+    for(i = 0; i < lc; i++) {
+        Light* l = ls[i];
+
+        if(l->radius <= 0.) {
+            g->uc++;
+            continue;
+        }
+
+        helper_bvh_push_extrema(sub_vv(l->pos, vec_aaa(l->radius)), &g->minima, &g->maxima);
+        helper_bvh_push_extrema(add_vv(l->pos, vec_aaa(l->radius)), &g->minima, &g->maxima);
+        bc++;
+    }
+
+    g->unbounded = malloc(MAX(1, g->uc) * sizeof *(g->unbounded));
+
+    size_t u = 0;
+    for(i = 0; i < lc; i++) if(ls[i]->radius <= 0.) g->unbounded[u++] = ls[i];
+
+    // Roughly one bounded light per cell, stretched along the longer axes
+    g->n[0] = g->n[1] = g->n[2] = 1;
+    if(bc) {
+        Vec d = sub_vv(g->maxima, g->minima);
+        double k = cbrt((double) bc / MAX(DBL_MIN, d.x * d.y * d.z));
+
+        g->n[0] = (size_t) MIN(LIGHT_GRID_MAX, MAX(1., ceil(d.x * k)));
+        g->n[1] = (size_t) MIN(LIGHT_GRID_MAX, MAX(1., ceil(d.y * k)));
+        g->n[2] = (size_t) MIN(LIGHT_GRID_MAX, MAX(1., ceil(d.z * k)));
+    } else {
+        g->minima = vec_aaa(0.);
+        g->maxima = vec_aaa(0.);
+    }
+
+    g->cell = (Vec) {
+        MAX(DBL_MIN, (g->maxima.x - g->minima.x) / (double) g->n[0]),
+        MAX(DBL_MIN, (g->maxima.y - g->minima.y) / (double) g->n[1]),
+        MAX(DBL_MIN, (g->maxima.z - g->minima.z) / (double) g->n[2])
+    };
+
+    size_t cc = g->n[0] * g->n[1] * g->n[2];
+
+    size_t* counts = calloc(cc, sizeof *counts);
+    for(i = 0; i < lc; i++) helper_light_grid_fill(g, ls[i], counts, NULL, NULL);
+
+    g->offsets = malloc((cc + 1) * sizeof *(g->offsets));
+    g->offsets[0] = 0;
+    for(i = 0; i < cc; i++) g->offsets[i + 1] = g->offsets[i] + counts[i];
+
+    g->items = malloc(MAX(1, g->offsets[cc]) * sizeof *(g->items));
+
+    memcpy(counts, g->offsets, cc * sizeof *counts);
+    for(i = 0; i < lc; i++) helper_light_grid_fill(g, ls[i], NULL, counts, g->items);
+
+    free(counts);
+    free(ls);
+
+    return g;
+}
+
+void light_grid_free(LightGrid* g) {
+    if(!g) return;
+
+    free(g->offsets);
+    free(g->items);
+    free(g->unbounded);
+    free(g);
+}
+
+// Writes the lights that may reach `p` to `out`, returns how many there are
+size_t light_grid_query(LightGrid* g, Vec p, Light*** out) {
+    if(!helper_bvh_contains_point(g->minima, g->maxima, p)) {
+        *out = g->unbounded;
+        return g->uc;
+    }
+
+    size_t ix, iy, iz;
+    size_t i = helper_light_grid_cell(g, p, &ix, &iy, &iz);
+
+    *out = g->items + g->offsets[i];
+
+    return g->offsets[i + 1] - g->offsets[i];
+}
+
+//
+// `ShadowCache` declaration, the last occluder found toward each light by one thread
+
+// Neighbouring shading points are usually shadowed by the same primitive, so it is
+// tested before traversing the hierarchy. Slots are direct-mapped by `Light` address
+typedef struct ShadowCache {
+    Light* lights[SHADOW_CACHE_SIZE];
+    Surface occluders[SHADOW_CACHE_SIZE];
+    size_t lookups;
+    size_t occluded;
+    size_t hits;
+} ShadowCache;
+
+// Totals over every thread's `ShadowCache` for a render
+// Only occluded shadow rays can be answered by the cache, so both hit rates are reported
+typedef struct ShadowStats {
+    size_t lookups;
+    size_t occluded;
+    size_t hits;
+} ShadowStats;
+
+ShadowCache shadow_cache_new(void) {
+    ShadowCache init;
+
+    memset(&init, 0, sizeof init);
+
+    return init;
+}
+
+size_t helper_shadow_cache_slot(Light* l) {
+    return (size_t) (((unsigned long long) (size_t) l >> 4) % SHADOW_CACHE_SIZE);
+}
+
+// Returns the cached occluder for `l`, with a `st` of NONE if there is none
+Surface shadow_cache_get(ShadowCache* sc, Light* l) {
+    size_t i = helper_shadow_cache_slot(l);
+
+    if(sc->lights[i] != l) return (Surface) { .st = NONE };
+
+    return sc->occluders[i];
+}
+
+void shadow_cache_put(ShadowCache* sc, Light* l, Surface occluder) {
+    size_t i = helper_shadow_cache_slot(l);
+
+    sc->lights[i] = l;
+    sc->occluders[i] = occluder;
+}
+
+// Adds a thread's counts to `stats`, safe to call from several threads at once
+void shadow_cache_merge(ShadowCache* sc, ShadowStats* stats) {
+    if(!stats) return;
+
+    #pragma omp atomic
+    stats->lookups += sc->lookups;
+
+    #pragma omp atomic
+    stats->occluded += sc->occluded;
+
+    #pragma omp atomic
+    stats->hits += sc->hits;
+}
+
+void shadow_stats_print(ShadowStats* stats) {
+    double rate = (stats->lookups) ? (double) stats->hits / (double) stats->lookups : 0.;
+    double occluded_rate = (stats->occluded) ? (double) stats->hits / (double) stats->occluded : 0.;
+
+    printf(
+        "(shadow stats) {\n"
+        "    lookups: %zu\n"
+        "    occluded: %zu\n"
+        "    hits: %zu\n"
+        "    hit rate: %lf\n"
+        "    occluded hit rate: %lf\n}\n",
+        stats->lookups, stats->occluded, stats->hits, rate, occluded_rate
+    );
+}
+
+#endif /* LIGHTS_H */
@@ -0,0 +1,314 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "buffer.h"
+#include "rt.h"
+
+#define LIVE_MAGIC 0x4556494cu
+#define LIVE_VERSION 1
+
+//
+// `LiveHeader` declaration, the start of a named shared memory framebuffer
+
+// Viewers map the segment read-only. Tile bits are set once a tile's pixels are in
+// place, and are only cleared when a new frame begins, under the seqlock `seq`
+// (odd while the header is being changed). Pixels start at `pixels` bytes in, stored
+// row-major like an untiled `Buffer`
+typedef struct LiveHeader {
+    unsigned magic;
+    unsigned version;
+    unsigned w;
+    unsigned h;
+    unsigned tile;
+    unsigned tiles_w;
+    unsigned tiles_h;
+    unsigned seq;
+    unsigned long frame;
+    unsigned long pixels;
+    unsigned char bitmap[];
+} LiveHeader;
+
+//
+// `Live` declaration, one side's handle on the segment
+
+// `remaining` counts each tile's unwritten pixels on the rendering side, NULL for viewers
+typedef struct Live {
+    char* name;
+    size_t len;
+    LiveHeader* header;
+    Buffer b;
+    unsigned* remaining;
+    void (*on_block)(void* data, size_t x, size_t y, size_t w, size_t h);
+    void* on_block_data;
+} Live;
+
+//
+// Helper functions
+
+size_t helper_live_tiles(LiveHeader* hd) {
+    return (size_t) hd->tiles_w * hd->tiles_h;
+}
+
+Live* helper_live_map(char* name, int fd, size_t len, int prot) {
+    void* ptr = mmap(NULL, len, prot, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(ptr == MAP_FAILED) return NULL;
+
+    Live* l = malloc(sizeof *l);
+    l->name = strdup(name);
+    l->len = len;
+    l->header = (LiveHeader*) ptr;
+    l->remaining = NULL;
+    l->on_block = NULL;
+    l->on_block_data = NULL;
+
+    return l;
+}
+
+void helper_live_buffer(Live* l) {
+    LiveHeader* hd = l->header;
+
+    // The pixels belong to the segment, but forked workers can write straight into them,
+    // see `raytrace_processes`
+    l->b = (Buffer) {
+        .w = hd->w,
+        .h = hd->h,
+        .tile = 0,
+        .vs = (char*) hd + hd->pixels,
+        .mapped = 0,
+        .shared = 1
+    };
+}
+
+//
+// Rendering side
+
+// Creates, or replaces, the segment `name` (see shm_open) for a `w` x `h` image whose
+// completion is tracked in `tile` x `tile` squares. A replaced segment is unlinked
+// rather than resized, so viewers still mapping it are unaffected. Returns NULL on failure
+// Render into `l->b` and release it with `live_close`, never `buffer_free`
+Live* live_open(char* name, size_t w, size_t h, size_t tile) {
+    assert(tile && "Error: Live tile size must not be 0");
+
+    size_t tiles_w = (w + tile - 1) / tile;
+    size_t tiles_h = (h + tile - 1) / tile;
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t pixels = (sizeof(LiveHeader) + (tiles_w * tiles_h + 7) / 8 + page - 1) / page * page;
+    size_t len = pixels + MAX(1, 3 * w * h);
+
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) return NULL;
+
+    if(ftruncate(fd, (off_t) len)) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    Live* l = helper_live_map(name, fd, len, PROT_READ | PROT_WRITE);
+    if(!l) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    LiveHeader* hd = l->header;
+    hd->version = LIVE_VERSION;
+    hd->w = (unsigned) w;
+    hd->h = (unsigned) h;
+    hd->tile = (unsigned) tile;
+    hd->tiles_w = (unsigned) tiles_w;
+    hd->tiles_h = (unsigned) tiles_h;
+    hd->seq = 0;
+    hd->frame = 0;
+    hd->pixels = pixels;
+
+    l->remaining = malloc(tiles_w * tiles_h * sizeof *(l->remaining));
+
+    helper_live_buffer(l);
+
+    // Viewers check the magic last, so they never see a half-written header
+    __atomic_store_n(&hd->magic, LIVE_MAGIC, __ATOMIC_RELEASE);
+
+    return l;
+}
+
+// Starts a new frame, clearing every tile bit. Pixels from the last frame stay until
+// they are overwritten
+void live_begin_frame(Live* l) {
+    LiveHeader* hd = l->header;
+
+    __atomic_store_n(&hd->seq, hd->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    hd->frame++;
+    memset(hd->bitmap, 0, (helper_live_tiles(hd) + 7) / 8);
+
+    __atomic_store_n(&hd->seq, hd->seq + 1, __ATOMIC_RELEASE);
+
+    size_t tx, ty;
+    for(ty = 0; ty < hd->tiles_h; ty++)
+        for(tx = 0; tx < hd->tiles_w; tx++) {
+            size_t tw = MIN(hd->tile, hd->w - tx * hd->tile);
+            size_t th = MIN(hd->tile, hd->h - ty * hd->tile);
+
+            l->remaining[tx + ty * hd->tiles_w] = (unsigned) (tw * th);
+        }
+}
+
+// Counts a rectangle of the `Buffer` as final, setting the bit of every tile it
+// completes. Safe to call from several threads at once
+void live_submit(Live* l, size_t x, size_t y, size_t w, size_t h) {
+    LiveHeader* hd = l->header;
+
+    size_t tx0 = x / hd->tile, tx1 = (x + w - 1) / hd->tile;
+    size_t ty0 = y / hd->tile, ty1 = (y + h - 1) / hd->tile;
+
+    size_t tx, ty;
+    for(ty = ty0; ty <= ty1 && ty < hd->tiles_h; ty++)
+        for(tx = tx0; tx <= tx1 && tx < hd->tiles_w; tx++) {
+            size_t x0 = MAX(x, tx * hd->tile), x1 = MIN(x + w, (tx + 1) * hd->tile);
+            size_t y0 = MAX(y, ty * hd->tile), y1 = MIN(y + h, (ty + 1) * hd->tile);
+
+            size_t i = tx + ty * hd->tiles_w;
+            unsigned covered = (unsigned) ((x1 - x0) * (y1 - y0));
+
+            // The pixels were written before this call, releasing the bit publishes them
+            if(__atomic_sub_fetch(&l->remaining[i], covered, __ATOMIC_ACQ_REL) == 0)
+                __atomic_fetch_or(&hd->bitmap[i / 8], (unsigned char) (1u << (i % 8)), __ATOMIC_RELEASE);
+        }
+}
+
+// Matches the signature of `Config.on_block`, passing blocks on to the hook it replaced
+void helper_live_hook(void* data, size_t x, size_t y, size_t w, size_t h) {
+    Live* l = (Live*) data;
+
+    live_submit(l, x, y, w, h);
+
+    if(l->on_block) l->on_block(l->on_block_data, x, y, w, h);
+}
+
+// Renders a frame into the segment, so viewers can watch tiles complete
+void raytrace_live(Live* l, Scene s, Config c) {
+    live_begin_frame(l);
+
+    l->on_block = c.on_block;
+    l->on_block_data = c.on_block_data;
+
+    c.on_block = helper_live_hook;
+    c.on_block_data = l;
+
+    raytrace(l->b, s, c);
+}
+
+//
+// Viewing side
+
+// Maps an existing segment read-only, returns NULL if it does not exist, is not ready
+// or is too short for the image its header describes
+Live* live_attach(char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) || (size_t) st.st_size < sizeof(LiveHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    Live* l = helper_live_map(name, fd, (size_t) st.st_size, PROT_READ);
+    if(!l) return NULL;
+
+    LiveHeader* hd = l->header;
+
+    int valid = __atomic_load_n(&hd->magic, __ATOMIC_ACQUIRE) == LIVE_MAGIC &&
+        hd->version == LIVE_VERSION && hd->tile &&
+        hd->tiles_w == (hd->w + (size_t) hd->tile - 1) / hd->tile &&
+        hd->tiles_h == (hd->h + (size_t) hd->tile - 1) / hd->tile;
+
+    // Sizes are widened first, so none of them can wrap
+    valid = valid && hd->pixels >= sizeof(LiveHeader) + (helper_live_tiles(hd) + 7) / 8 &&
+        hd->pixels <= l->len && l->len - hd->pixels >= 3 * (size_t) hd->w * hd->h;
+
+    if(!valid) {
+        munmap(hd, l->len);
+        free(l->name);
+        free(l);
+        return NULL;
+    }
+
+    helper_live_buffer(l);
+
+    return l;
+}
+
+// Copies the frame counter and the tile bits as of one consistent moment, `bitmap`
+// needs a bit per tile. Returns the frame counter
+unsigned long live_snapshot(Live* l, unsigned char* bitmap) {
+    LiveHeader* hd = l->header;
+
+    for(;;) {
+        unsigned seq = __atomic_load_n(&hd->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) continue;
+
+        unsigned long frame = hd->frame;
+
+        size_t i;
+        for(i = 0; i < (helper_live_tiles(hd) + 7) / 8; i++)
+            bitmap[i] = __atomic_load_n(&hd->bitmap[i], __ATOMIC_ACQUIRE);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if(__atomic_load_n(&hd->seq, __ATOMIC_RELAXED) == seq) return frame;
+    }
+}
+
+int live_tile_ready(unsigned char* bitmap, size_t i) {
+    return (bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+// Copies ready tile `i` of `frame` to `out`, row-major, straight from the segment
+// Returns 1 if a new frame began meanwhile, in which case `out` may be torn
+int live_read_tile(Live* l, size_t i, unsigned long frame, char* out) {
+    LiveHeader* hd = l->header;
+
+    size_t tx = i % hd->tiles_w, ty = i / hd->tiles_w;
+    size_t tw = MIN(hd->tile, hd->w - tx * hd->tile);
+    size_t th = MIN(hd->tile, hd->h - ty * hd->tile);
+
+    size_t y;
+    for(y = 0; y < th; y++)
+        memcpy(out + 3 * y * tw, l->b.vs + helper_buffer_index(l->b, tx * hd->tile, ty * hd->tile + y), 3 * tw);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    unsigned seq = __atomic_load_n(&hd->seq, __ATOMIC_ACQUIRE);
+
+    return (seq & 1) || hd->frame != frame;
+}
+
+// Unmaps the segment, the rendering side also removes its name
+void live_close(Live* l) {
+    if(!l) return;
+
+    if(l->remaining) shm_unlink(l->name);
+
+    munmap(l->header, l->len);
+
+    free(l->remaining);
+    free(l->name);
+    free(l);
+}
+
+#endif /* LIVE_H */
@@ -0,0 +1,164 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include<stdlib.h>
+#include<stdio.h>
+
+#ifdef __linux__
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#endif
+
+#include "lalg.h"
+
+#define NUMA_MAX_NODES 64
+
+// From <numaif.h>, which only ships with libnuma
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_INTERLEAVE 3
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+
+//
+// NUMA placement, through the raw system calls so libnuma is not required
+// Everything degrades to a no-op on single node machines and kernels without NUMA,
+// and off Linux, where arenas come from the heap
+
+#ifdef __linux__
+
+// Number of NUMA nodes, from the highest node listed as online
+size_t numa_nodes(void) {
+    FILE* f = fopen("/sys/devices/system/node/online", "r");
+    if(!f) return 1;
+
+    unsigned lo, hi, highest = 0;
+    char sep;
+
+    while(fscanf(f, "%u", &lo) == 1) {
+        hi = lo;
+
+        if(fscanf(f, "%c", &sep) == 1 && sep == '-') {
+            if(fscanf(f, "%u", &hi) != 1) break;
+            if(fscanf(f, "%c", &sep) != 1) sep = '\n';
+        }
+
+        highest = MAX(highest, hi);
+
+        if(sep != ',') break;
+    }
+
+    fclose(f);
+
+    return MIN(NUMA_MAX_NODES, (size_t) highest + 1);
+}
+
+// Node of the CPU the calling thread is running on, stable once the thread is pinned
+size_t numa_current_node(void) {
+    unsigned cpu = 0, node = 0;
+
+    if(syscall(SYS_getcpu, &cpu, &node, NULL)) return 0;
+
+    return node;
+}
+
+//
+// Helper functions
+
+// Shrinks `[ptr, ptr + len)` to the whole pages inside it, returns 0 if there are none
+size_t helper_numa_pages(void* ptr, size_t len, char** start) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+    size_t lo = ((size_t) ptr + page - 1) / page * page;
+    size_t hi = ((size_t) ptr + len) / page * page;
+
+    *start = (char*) lo;
+
+    return (hi > lo) ? hi - lo : 0;
+}
+
+int helper_numa_mbind(void* ptr, size_t len, int mode, unsigned long mask, unsigned flags) {
+    return syscall(SYS_mbind, ptr, len, mode, &mask, NUMA_MAX_NODES + 1, flags) != 0;
+}
+
+//
+// Placement functions
+
+// Interleaves the pages of an existing allocation over the first `nodes` nodes, moving
+// pages that are already resident. Partial pages at either end are left in place
+// Returns 1 on failure
+int numa_spread(void* ptr, size_t len, size_t nodes) {
+    if(nodes < 2) return 0;
+
+    char* start;
+    size_t pages = helper_numa_pages(ptr, len, &start);
+    if(!pages) return 0;
+
+    unsigned long mask = (nodes >= NUMA_MAX_NODES) ? ~0ul : (1ul << nodes) - 1;
+
+    return helper_numa_mbind(start, pages, NUMA_MPOL_INTERLEAVE, mask, NUMA_MPOL_MF_MOVE);
+}
+
+// Asks for transparent huge pages behind an existing allocation, returns 1 on failure
+int numa_hugepages(void* ptr, size_t len) {
+    char* start;
+    size_t pages = helper_numa_pages(ptr, len, &start);
+    if(!pages) return 0;
+
+    return madvise(start, pages, MADV_HUGEPAGE) != 0;
+}
+
+// Maps `len` bytes that prefer `node`, backed by huge pages if `huge` is set
+// Returns NULL on failure, release with `numa_arena_free`
+void* numa_arena(size_t len, size_t node, int huge) {
+    void* ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED) return NULL;
+
+    if(huge) madvise(ptr, len, MADV_HUGEPAGE);
+
+    // Nothing is resident yet, so the first touch already lands on `node`
+    if(numa_nodes() > 1) helper_numa_mbind(ptr, len, NUMA_MPOL_PREFERRED, 1ul << node, 0);
+
+    return ptr;
+}
+
+void numa_arena_free(void* ptr, size_t len) {
+    if(ptr) munmap(ptr, len);
+}
+
+#else
+
+size_t numa_nodes(void) {
+    return 1;
+}
+
+size_t numa_current_node(void) {
+    return 0;
+}
+
+int numa_spread(void* ptr, size_t len, size_t nodes) {
+    (void) ptr; (void) len; (void) nodes;
+
+    return 0;
+}
+
+int numa_hugepages(void* ptr, size_t len) {
+    (void) ptr; (void) len;
+
+    return 0;
+}
+
+void* numa_arena(size_t len, size_t node, int huge) {
+    (void) node; (void) huge;
+
+    return calloc(1, len);
+}
+
+void numa_arena_free(void* ptr, size_t len) {
+    (void) len;
+
+    free(ptr);
+}
+
+#endif /* __linux__ */
+
+#endif /* NUMA_H */
@@ -0,0 +1,267 @@
+#ifndef OUT_H
+#define OUT_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<pthread.h>
+
+#include "buffer.h"
+#include "rt.h"
+
+//
+// `ImageFormat` declaration
+
+typedef enum ImageFormat { PPM = 0, QOI } ImageFormat;
+
+//
+// `Writer` declaration, a background thread that encodes rows as they complete
+
+typedef struct Writer {
+    Buffer b;
+    FILE* f;
+    ImageFormat fmt;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t* remaining;
+    size_t ready;
+    int closing;
+    unsigned char qoi_index[64 * 4];
+    unsigned char qoi_prev[3];
+    size_t qoi_run;
+} Writer;
+
+//
+// QOI encoding, see https://qoiformat.org/qoi-specification.pdf
+
+void helper_writer_qoi_u32(FILE* f, size_t val) {
+    fputc((int) ((val >> 24) & 0xFF), f);
+    fputc((int) ((val >> 16) & 0xFF), f);
+    fputc((int) ((val >> 8) & 0xFF), f);
+    fputc((int) (val & 0xFF), f);
+}
+
+void helper_writer_qoi_header(Writer* w) {
+    fwrite("qoif", 1, 4, w->f);
+
+    helper_writer_qoi_u32(w->f, w->b.w);
+    helper_writer_qoi_u32(w->f, w->b.h);
+
+    fputc(3, w->f); // RGB
+    fputc(0, w->f); // sRGB with linear alpha
+
+    memset(w->qoi_index, 0, sizeof w->qoi_index);
+
+    w->qoi_prev[0] = 0;
+    w->qoi_prev[1] = 0;
+    w->qoi_prev[2] = 0;
+    w->qoi_run = 0;
+}
+
+void helper_writer_qoi_flush_run(Writer* w) {
+    if(!w->qoi_run) return;
+
+    fputc((int) (0xC0 | (w->qoi_run - 1)), w->f);
+    w->qoi_run = 0;
+}
+
+// Pixels are fully opaque, which the hash and the op selection below assume
+// The index keeps alpha like the reference encoder, so an unused slot, which decoders
+// hold as transparent black, never matches an opaque black pixel
+void helper_writer_qoi_pixel(Writer* w, unsigned char* px) {
+    unsigned char* prev = w->qoi_prev;
+
+    if(px[0] == prev[0] && px[1] == prev[1] && px[2] == prev[2]) {
+        if(++w->qoi_run == 62) helper_writer_qoi_flush_run(w);
+        return;
+    }
+
+    helper_writer_qoi_flush_run(w);
+
+    size_t h = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+    unsigned char* slot = &w->qoi_index[h * 4];
+
+    if(slot[0] == px[0] && slot[1] == px[1] && slot[2] == px[2] && slot[3] == 255)
+        fputc((int) h, w->f);
+    else {
+        memcpy(slot, px, 3);
+        slot[3] = 255;
+
+        signed char dr = (signed char) (px[0] - prev[0]);
+        signed char dg = (signed char) (px[1] - prev[1]);
+        signed char db = (signed char) (px[2] - prev[2]);
+
+        signed char dr_dg = (signed char) (dr - dg);
+        signed char db_dg = (signed char) (db - dg);
+
+        if(dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+            fputc(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2), w->f);
+        else if(dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+            fputc(0x80 | (dg + 32), w->f);
+            fputc((dr_dg + 8) << 4 | (db_dg + 8), w->f);
+        } else {
+            fputc(0xFE, w->f);
+            fwrite(px, 1, 3, w->f);
+        }
+    }
+
+    memcpy(prev, px, 3);
+}
+
+void helper_writer_qoi_end(Writer* w) {
+    helper_writer_qoi_flush_run(w);
+
+    size_t i;
+    for(i = 0; i < 7; i++) fputc(0, w->f);
+    fputc(1, w->f);
+}
+
+//
+// Background thread
+
+void helper_writer_rows(Writer* w, size_t start, size_t end, char* row) {
+    size_t y, x;
+    for(y = start; y < end; y++) {
+        buffer_read_row(w->b, y, row);
+
+        if(w->fmt == PPM) fwrite(row, 1, 3 * w->b.w, w->f);
+        else for(x = 0; x < w->b.w; x++)
+            helper_writer_qoi_pixel(w, (unsigned char*) row + 3 * x);
+    }
+}
+
+void* helper_writer_main(void* data) {
+    Writer* w = (Writer*) data;
+
+    char* row = malloc(3 * w->b.w);
+
+    size_t written = 0;
+    while(written < w->b.h) {
+        pthread_mutex_lock(&w->lock);
+
+        while(written == w->ready && !w->closing) pthread_cond_wait(&w->cond, &w->lock);
+
+        // Rows that never completed are written as they stand once the `Writer` closes
+        size_t end = (w->closing) ? w->b.h : w->ready;
+
+        pthread_mutex_unlock(&w->lock);
+
+        helper_writer_rows(w, written, end, row);
+        written = end;
+    }
+
+    if(w->fmt == QOI) helper_writer_qoi_end(w);
+
+    free(row);
+
+    return NULL;
+}
+
+//
+// `Writer` functions
+
+// Returns NULL if the file could not be opened or the writer thread could not start
+Writer* writer_open(Buffer b, char* file, ImageFormat fmt) {
+    FILE* f = fopen(file, "wb+");
+    if(!f) return NULL;
+
+    Writer* w = malloc(sizeof *w);
+    w->b = b;
+    w->f = f;
+    w->fmt = fmt;
+    w->remaining = malloc(b.h * sizeof *(w->remaining));
+    w->ready = 0;
+    w->closing = 0;
+
+    size_t y;
+    for(y = 0; y < b.h; y++) w->remaining[y] = b.w;
+
+    if(fmt == PPM) {
+        size_t s_len;
+        char* s = helper_buffer_ppm_header(b, &s_len);
+
+        fwrite(s, 1, s_len, f);
+        free(s);
+    } else helper_writer_qoi_header(w);
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if(pthread_create(&w->thread, NULL, helper_writer_main, w)) {
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+
+        fclose(f);
+        free(w->remaining);
+        free(w);
+
+        return NULL;
+    }
+
+    return w;
+}
+
+// Marks a rectangle of the `Buffer` as final, completed rows are handed to the writer thread
+void writer_submit(Writer* w, size_t x, size_t y, size_t tw, size_t th) {
+    (void) x;
+
+    pthread_mutex_lock(&w->lock);
+
+    size_t j;
+    for(j = y; j < y + th && j < w->b.h; j++) w->remaining[j] -= MIN(tw, w->remaining[j]);
+
+    size_t ready = w->ready;
+    while(ready < w->b.h && !w->remaining[ready]) ready++;
+
+    if(ready != w->ready) {
+        w->ready = ready;
+        pthread_cond_signal(&w->cond);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Matches the signature of `Config.on_block`
+void helper_writer_hook(void* data, size_t x, size_t y, size_t w, size_t h) {
+    writer_submit((Writer*) data, x, y, w, h);
+}
+
+// Waits for the remaining rows to be written, returns 1 if writing failed
+int writer_close(Writer* w) {
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+
+    int failed = ferror(w->f) != 0;
+    failed |= fclose(w->f) != 0;
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+
+    free(w->remaining);
+    free(w);
+
+    return failed;
+}
+
+//
+// Render straight to a file, overlapping encoding with rendering
+
+// Returns 1 if the file could not be opened or written
+int raytrace_to_file(Buffer b, Scene s, Config c, char* file, ImageFormat fmt) {
+    Writer* w = writer_open(b, file, fmt);
+    if(!w) return 1;
+
+    c.on_block = helper_writer_hook;
+    c.on_block_data = w;
+
+    raytrace(b, s, c);
+
+    return writer_close(w);
+}
+
+#endif /* OUT_H */
@@ -0,0 +1,202 @@
+#ifndef PACE_H
+#define PACE_H
+
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<omp.h>
+
+#include "buffer.h"
+#include "rt.h"
+
+#define PACE_STEP 1.5
+#define PACE_SMOOTHING 0.5
+#define PACE_SIGMA 24.
+
+//
+// `Pacer` declaration, the state carried between frames rendered to a deadline
+
+// `cost` is the smoothed time per traced pixel, 0 until a frame has been timed, and
+// `upsample` the smoothed time per output pixel of upsampling, 0 until one was upsampled
+// `w` and `h` are the internal resolution of the last frame
+// `low` is the internal `Buffer`, kept while its size does not change
+typedef struct Pacer {
+    double budget;
+    double min_scale;
+    double scale;
+    double cost;
+    double upsample;
+    size_t w;
+    size_t h;
+    Camera last;
+    int moved;
+    size_t rest;
+    Buffer low;
+} Pacer;
+
+// `budget` is in seconds per frame, resolution never drops below `min_scale` per axis
+Pacer pacer_new(double budget, double min_scale) {
+    assert((min_scale > 0. && min_scale <= 1.) && "Error: Pacer scale must lie in (0, 1]");
+
+    return (Pacer) {
+        .budget = budget,
+        .min_scale = min_scale,
+        .scale = 1.,
+        .cost = 0.,
+        .upsample = 0.,
+        .w = 0,
+        .h = 0,
+        .moved = 1,
+        .rest = 0,
+        .low = (Buffer) { .w = 0, .h = 0, .tile = 0, .vs = NULL, .mapped = 0, .shared = 0 }
+    };
+}
+
+void pacer_free(Pacer* p) {
+    buffer_free(&p->low);
+}
+
+//
+// Helper functions
+
+// Exponential moving average, `last` is 0 before the first sample
+double helper_pace_smooth(double last, double sample) {
+    return (last > 0.) ? PACE_SMOOTHING * last + (1. - PACE_SMOOTHING) * sample : sample;
+}
+
+// Rounds a scaled dimension to whole blocks, at least one
+size_t helper_pace_dim(size_t full, double scale, size_t block_size) {
+    size_t blocks = (size_t) floor((double) full * scale / (double) block_size + 0.5);
+
+    return MAX(1, blocks) * block_size;
+}
+
+double helper_pace_diff(unsigned char* a, unsigned char* b) {
+    double d = 0.;
+
+    size_t i;
+    for(i = 0; i < 3; i++) d += ((double) a[i] - (double) b[i]) * ((double) a[i] - (double) b[i]);
+
+    return d;
+}
+
+// Bilinear upsampling where each of the four taps is weighted down by how far its
+// color is from the nearest tap's, so edges stay sharp instead of smearing
+void helper_pace_upsample(Buffer low, Buffer b, Config c) {
+    double sx = (double) low.w / (double) b.w;
+    double sy = (double) low.h / (double) b.h;
+
+    long y;
+
+    #pragma omp parallel for schedule(dynamic, 8) num_threads(config_threads(c))
+    for(y = 0; y < (long) b.h; y++) {
+        double fy = MAX(0., ((double) y + 0.5) * sy - 0.5);
+        size_t y0 = MIN(low.h - 1, (size_t) fy);
+        size_t y1 = MIN(low.h - 1, y0 + 1);
+        double ty = fy - (double) y0;
+
+        size_t x;
+        for(x = 0; x < b.w; x++) {
+            double fx = MAX(0., ((double) x + 0.5) * sx - 0.5);
+            size_t x0 = MIN(low.w - 1, (size_t) fx);
+            size_t x1 = MIN(low.w - 1, x0 + 1);
+            double tx = fx - (double) x0;
+
+            unsigned char* taps[4] = {
+                (unsigned char*) low.vs + helper_buffer_index(low, x0, y0),
+                (unsigned char*) low.vs + helper_buffer_index(low, x1, y0),
+                (unsigned char*) low.vs + helper_buffer_index(low, x0, y1),
+                (unsigned char*) low.vs + helper_buffer_index(low, x1, y1)
+            };
+
+            double weights[4] = {
+                (1. - tx) * (1. - ty),
+                tx * (1. - ty),
+                (1. - tx) * ty,
+                tx * ty
+            };
+
+            size_t nearest = (tx >= 0.5) + 2 * (ty >= 0.5);
+
+            double sum = 0., color[3] = { 0., 0., 0. };
+
+            size_t i, k;
+            for(i = 0; i < 4; i++) {
+                double w = weights[i] * exp(-1. * helper_pace_diff(taps[i], taps[nearest]) / (PACE_SIGMA * PACE_SIGMA));
+
+                for(k = 0; k < 3; k++) color[k] += w * (double) taps[i][k];
+                sum += w;
+            }
+
+            char* px = b.vs + helper_buffer_index(b, x, (size_t) y);
+            for(k = 0; k < 3; k++) px[k] = (char) (unsigned char) (color[k] / sum + 0.5);
+        }
+    }
+}
+
+//
+// Deadline-driven `raytrace` function
+
+// Renders at the largest scale the recent per-pixel costs of tracing and upsampling
+// allow within `p->budget`, upsampling into `b` when below full resolution. While the
+// camera is at rest the scale grows by PACE_STEP each frame regardless, so a still view
+// sharpens to full resolution
+// `c.tile_costs` only applies to full resolution frames, and `c.on_block` is called once
+// for the whole `Buffer` on upsampled ones. Returns the frame time in seconds
+double raytrace_paced(Buffer b, Scene s, Config c, Pacer* p) {
+    assert(s.tt && "Error: Scene was not initialized");
+
+    Camera cam = s.camera;
+    p->moved = memcmp(&cam, &p->last, sizeof cam) != 0;
+    p->rest = (p->moved) ? 0 : p->rest + 1;
+    p->last = cam;
+
+    double scale = 1.;
+    double pixels = (double) (b.w * b.h);
+
+    // Any frame below full resolution also pays for upsampling every output pixel
+    if(p->cost > 0. && p->budget / p->cost < pixels) {
+        double affordable = MAX(0., p->budget - p->upsample * pixels) / p->cost;
+        scale = sqrt(affordable / pixels);
+    }
+
+    if(p->rest) scale = MAX(scale, p->scale * PACE_STEP);
+
+    p->scale = MIN(1., MAX(p->min_scale, scale));
+
+    size_t lw = MIN(b.w, helper_pace_dim(b.w, p->scale, c.block_size));
+    size_t lh = MIN(b.h, helper_pace_dim(b.h, p->scale, c.block_size));
+
+    p->w = lw;
+    p->h = lh;
+
+    double start = omp_get_wtime();
+    double traced;
+
+    if(lw == b.w && lh == b.h) {
+        raytrace(b, s, c);
+        traced = omp_get_wtime() - start;
+    } else {
+        if(p->low.w != lw || p->low.h != lh) {
+            buffer_free(&p->low);
+            p->low = buffer_wh(lw, lh);
+        }
+
+        Config lc = c;
+        lc.on_block = NULL;
+
+        raytrace(p->low, s, lc);
+        traced = omp_get_wtime() - start;
+
+        helper_pace_upsample(p->low, b, c);
+        p->upsample = helper_pace_smooth(p->upsample, (omp_get_wtime() - start - traced) / pixels);
+
+        if(c.on_block) c.on_block(c.on_block_data, 0, 0, b.w, b.h);
+    }
+
+    p->cost = helper_pace_smooth(p->cost, traced / (double) (lw * lh));
+
+    return omp_get_wtime() - start;
+}
+
+#endif /* PACE_H */
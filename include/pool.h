@@ -0,0 +1,169 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include<stdlib.h>
+#include<string.h>
+#include<omp.h>
+
+#ifdef __linux__
+#include<unistd.h>
+#include<sys/syscall.h>
+#endif
+
+#include "lalg.h"
+
+#define POOL_MAX_CPUS 1024
+#define POOL_MASK_WORDS (POOL_MAX_CPUS / (8 * sizeof(unsigned long)))
+
+//
+// `Pool` declaration, the worker threads every parallel region of the renderer runs on
+
+// OpenMP keeps its threads alive between parallel regions of the same size, so fixing
+// the team size once, rather than per frame, lets frames, hierarchy builds and loaders
+// all reuse the same threads. With `pinned` set each thread stays on one of `cpus`
+typedef struct Pool {
+    size_t threads;
+    int pinned;
+    size_t cc;
+    int* cpus;
+    unsigned long mask[POOL_MASK_WORDS];
+} Pool;
+
+//
+// Helper functions
+
+// Writes the affinity mask of the calling thread to `mask`, returns 1 on failure
+// Affinity is only supported on Linux, elsewhere both always fail and nothing is pinned
+int helper_pool_get_mask(unsigned long* mask) {
+    memset(mask, 0, POOL_MASK_WORDS * sizeof *mask);
+
+#ifdef __linux__
+    return syscall(SYS_sched_getaffinity, 0, POOL_MASK_WORDS * sizeof *mask, mask) <= 0;
+#else
+    return 1;
+#endif
+}
+
+int helper_pool_set_mask(unsigned long* mask) {
+#ifdef __linux__
+    return syscall(SYS_sched_setaffinity, 0, POOL_MASK_WORDS * sizeof *mask, mask) != 0;
+#else
+    (void) mask;
+
+    return 1;
+#endif
+}
+
+int helper_pool_pin(int cpu) {
+    unsigned long mask[POOL_MASK_WORDS];
+    memset(mask, 0, sizeof mask);
+
+    size_t bits = 8 * sizeof *mask;
+    mask[(size_t) cpu / bits] = 1ul << ((size_t) cpu % bits);
+
+    return helper_pool_set_mask(mask);
+}
+
+// Lists the CPUs the process may run on, falling back to every online CPU
+size_t helper_pool_cpus(unsigned long* mask, int* cpus) {
+    size_t bits = 8 * sizeof *mask;
+    size_t cc = 0;
+
+    if(!helper_pool_get_mask(mask)) {
+        size_t i;
+        for(i = 0; i < POOL_MAX_CPUS; i++)
+            if(mask[i / bits] >> (i % bits) & 1ul) {
+                if(cpus) cpus[cc] = (int) i;
+                cc++;
+            }
+    }
+
+    if(cc) return cc;
+
+    int online = omp_get_num_procs();
+    cc = (size_t) MAX(1, MIN(POOL_MAX_CPUS, online));
+
+    memset(mask, 0, POOL_MASK_WORDS * sizeof *mask);
+
+    size_t i;
+    for(i = 0; i < cc; i++) {
+        if(cpus) cpus[i] = (int) i;
+        mask[i / bits] |= 1ul << (i % bits);
+    }
+
+    return cc;
+}
+
+//
+// `Pool` functions
+
+// Number of CPUs the process may run on
+size_t pool_cores(void) {
+    unsigned long mask[POOL_MASK_WORDS];
+
+    return helper_pool_cpus(mask, NULL);
+}
+
+// A `threads` of 0 uses one thread per available core. With `pin` set, thread `i` is
+// bound to the `i`th available core (wrapping around), except the calling thread, which
+// keeps its mask so threads it starts later are not confined to one core
+// Only one `Pool` should exist at a time, it sets the OpenMP defaults for the process
+Pool* pool_new(size_t threads, int pin) {
+    Pool* p = malloc(sizeof *p);
+
+    p->cc = helper_pool_cpus(p->mask, NULL);
+    p->cpus = malloc(p->cc * sizeof *(p->cpus));
+
+    helper_pool_cpus(p->mask, p->cpus);
+
+    p->threads = (threads) ? threads : p->cc;
+    p->pinned = 0;
+
+    // Nothing can be pinned where the affinity mask cannot be read
+    unsigned long mask[POOL_MASK_WORDS];
+    if(helper_pool_get_mask(mask)) pin = 0;
+
+    omp_set_dynamic(0);
+    omp_set_num_threads((int) p->threads);
+
+    // Starts the team, so the first frame does not pay for creating it
+    int failed = 0;
+
+    #pragma omp parallel num_threads((int) p->threads) reduction(|:failed)
+    {
+        size_t i = (size_t) omp_get_thread_num();
+
+        if(pin && i) failed |= helper_pool_pin(p->cpus[i % p->cc]);
+    }
+
+    p->pinned = pin && !failed;
+
+    return p;
+}
+
+// Applies the `Pool`'s placement to the calling OpenMP thread. Teams started from threads
+// other than the one that created the `Pool` should call this first in each region
+// Returns 1 on failure
+int pool_pin_thread(Pool* p) {
+    if(!p) return 0;
+    if(!p->pinned) return helper_pool_set_mask(p->mask);
+
+    return helper_pool_pin(p->cpus[(size_t) omp_get_thread_num() % p->cc]);
+}
+
+// Returns every thread of the team to the affinity the process started with
+void pool_free(Pool* p) {
+    if(!p) return;
+
+    if(p->pinned) {
+        #pragma omp parallel num_threads((int) p->threads)
+        {
+            helper_pool_set_mask(p->mask);
+        }
+    }
+
+    free(p->cpus);
+    free(p);
+}
+
+#endif /* POOL_H */
@@ -0,0 +1,268 @@
+#ifndef PROC_H
+#define PROC_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/types.h>
+#include<sys/wait.h>
+
+#include "rt.h"
+#include "pool.h"
+#include "image.h"
+
+#define PROC_RETRIES 3
+#define PROC_POLL_US 1000
+
+//
+// `TileQueue` declaration, the `Block`s shared between a coordinator and its workers
+
+// A slot's `state` is TILE_PENDING, TILE_DONE, TILE_FAILED, or the pid of the worker
+// that claimed it, so a claim and its owner are published by a single atomic exchange
+typedef enum TileState { TILE_PENDING = 0, TILE_DONE = -1, TILE_FAILED = -2 } TileState;
+
+typedef struct TileSlot {
+    int state;
+    int attempts;
+} TileSlot;
+
+// Lives in a shared mapping, once workers are forked every field is accessed atomically
+typedef struct TileQueue {
+    size_t len;
+    size_t next;
+    size_t bc;
+    size_t block_w;
+    size_t block_size;
+    TileSlot slots[];
+} TileQueue;
+
+TileQueue* tile_queue_new(size_t block_w, size_t block_h, size_t block_size) {
+    size_t bc = block_w * block_h;
+    size_t len = sizeof(TileQueue) + bc * sizeof(TileSlot);
+
+    TileQueue* q = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(q == MAP_FAILED) return NULL;
+
+    // Anonymous mappings start zeroed, so every slot is already TILE_PENDING
+    q->len = len;
+    q->next = 0;
+    q->bc = bc;
+    q->block_w = block_w;
+    q->block_size = block_size;
+
+    return q;
+}
+
+void tile_queue_free(TileQueue* q) {
+    if(q) munmap(q, q->len);
+}
+
+// Number of slots in `state`, pass a pid for the slots that worker holds
+size_t tile_queue_count(TileQueue* q, int state) {
+    size_t i, count = 0;
+    for(i = 0; i < q->bc; i++) count += __atomic_load_n(&q->slots[i].state, __ATOMIC_ACQUIRE) == state;
+
+    return count;
+}
+
+//
+// Helper functions
+
+int helper_tile_queue_take(TileQueue* q, size_t k, int self) {
+    int expected = TILE_PENDING;
+
+    return __atomic_compare_exchange_n(&q->slots[k].state, &expected, self, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Claims the next `Block` for the worker `self`, returns 1 once nothing is left
+// Blocks are handed out in order, then the queue is swept for ones given back
+int helper_tile_queue_claim(TileQueue* q, int self, size_t* k) {
+    for(;;) {
+        size_t i = __atomic_fetch_add(&q->next, 1, __ATOMIC_ACQ_REL);
+        if(i >= q->bc) break;
+
+        if(helper_tile_queue_take(q, i, self)) {
+            *k = i;
+            return 0;
+        }
+    }
+
+    size_t i;
+    for(i = 0; i < q->bc; i++)
+        if(helper_tile_queue_take(q, i, self)) {
+            *k = i;
+            return 0;
+        }
+
+    return 1;
+}
+
+// Gives the `Block`s of a dead worker back, or fails them after PROC_RETRIES attempts
+// Returns how many were given back
+size_t helper_tile_queue_requeue(TileQueue* q, int dead) {
+    size_t i, requeued = 0;
+    for(i = 0; i < q->bc; i++) {
+        TileSlot* slot = &q->slots[i];
+
+        if(__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != dead) continue;
+
+        int failed = ++slot->attempts >= PROC_RETRIES;
+
+        __atomic_store_n(&slot->state, (failed) ? TILE_FAILED : TILE_PENDING, __ATOMIC_RELEASE);
+        requeued += !failed;
+    }
+
+    return requeued;
+}
+
+// Body of a worker process, which never returns
+// Workers trace single-threaded, pinned to a core of their own when the pool is pinned,
+// with a `Scene` of their own loaded from the image
+void helper_proc_worker(Buffer b, SceneImage* im, Config c, TileQueue* q, size_t index) {
+    if(c.pool && c.pool->pinned) helper_pool_pin(c.pool->cpus[index % c.pool->cc]);
+
+    ShadowCache cache = shadow_cache_new();
+
+    c.pool = NULL;
+    c.threads = 1;
+    c.shadow_cache = &cache;
+    c.shadow_stats = NULL;
+    c.on_block = NULL;
+
+    Scene ts = scene_image_load(im);
+
+    size_t block_size = q->block_size;
+    char* tile = malloc(3 * block_size * block_size);
+
+    int self = (int) getpid();
+
+    size_t k;
+    while(!helper_tile_queue_claim(q, self, &k)) {
+        size_t n = k;
+        Block blk = next_block(&n, q->block_w, q->bc / q->block_w, block_size);
+
+        helper_raytrace_block(b, ts, c, blk, tile);
+
+        // Releasing the slot publishes the pixels written above
+        __atomic_store_n(&q->slots[k].state, TILE_DONE, __ATOMIC_RELEASE);
+    }
+
+    free(tile);
+    scene_free(&ts);
+
+    _exit(0);
+}
+
+int helper_proc_spawn(Buffer b, SceneImage* im, Config c, TileQueue* q, size_t index) {
+    pid_t pid = fork();
+
+    if(!pid) helper_proc_worker(b, im, c, q, index);
+
+    return (int) pid;
+}
+
+//
+// Multi-process `raytrace` function
+
+// Forks `workers` processes (0 for one per thread of `c`) that claim `Block`s from a
+// shared queue and write them straight into a shared `Buffer`. The `Scene` is written
+// to a `SceneImage` under P_tmpdir, which every worker maps and loads its own copy from
+// A worker that dies has its claimed `Block`s given back and is replaced, until a
+// `Block` has failed PROC_RETRIES times. `c.on_block` is called once, for the whole image
+// Returns 1 if any `Block` could not be rendered
+int raytrace_processes(Buffer b, Scene s, Config c, size_t workers) {
+    assert(s.tt && "Error: Scene was not initialized");
+    assert((b.w % c.block_size == 0 && b.h % c.block_size == 0) &&
+        "Error: Image dimensions must be cleanly divisible by block size");
+
+    workers = (workers) ? workers : config_threads(c);
+
+    size_t block_w = b.w / c.block_size;
+    size_t block_h = b.h / c.block_size;
+
+    // The file is only needed until it is mapped, the mapping outlives it
+    char path[] = P_tmpdir "/rt-scene-XXXXXX";
+
+    int fd = mkstemp(path);
+    if(fd < 0) return 1;
+
+    close(fd);
+
+    SceneImage* im = (scene_image_write(&s, path)) ? NULL : scene_image_open(path);
+    unlink(path);
+
+    if(!im) return 1;
+
+    Buffer shared = (b.shared) ? b : buffer_wh_shared(b.w, b.h);
+    TileQueue* q = (shared.vs) ? tile_queue_new(block_w, block_h, c.block_size) : NULL;
+
+    if(!q) {
+        if(!b.shared) buffer_free(&shared);
+        scene_image_close(im);
+        return 1;
+    }
+
+    int* pids = malloc(workers * sizeof *pids);
+
+    // Unflushed output would otherwise be duplicated by every worker
+    fflush(stdout);
+
+    size_t i, live = 0;
+    for(i = 0; i < workers; i++) {
+        pids[i] = helper_proc_spawn(shared, im, c, q, i);
+        live += pids[i] > 0;
+    }
+
+    size_t respawns = 0;
+
+    // Only the workers are waited on, so other children of the caller are left alone
+    while(live) {
+        size_t reaped = 0;
+
+        for(i = 0; i < workers; i++) {
+            if(pids[i] <= 0) continue;
+
+            int status;
+            pid_t pid = waitpid((pid_t) pids[i], &status, WNOHANG);
+            if(!pid) continue;
+
+            pids[i] = -1;
+            live--;
+            reaped++;
+
+            if(pid < 0 || (WIFEXITED(status) && !WEXITSTATUS(status))) continue;
+
+            helper_tile_queue_requeue(q, (int) pid);
+
+            if(!tile_queue_count(q, TILE_PENDING) || respawns >= PROC_RETRIES * workers) continue;
+
+            pids[i] = helper_proc_spawn(shared, im, c, q, i);
+            live += pids[i] > 0;
+            respawns++;
+        }
+
+        if(!reaped) usleep(PROC_POLL_US);
+    }
+
+    int failed = tile_queue_count(q, TILE_DONE) != q->bc;
+
+    if(!b.shared) {
+        size_t y;
+        for(y = 0; y < b.h; y++) buffer_write_tile(b, 0, y, b.w, 1, shared.vs + 3 * y * b.w);
+
+        buffer_free(&shared);
+    }
+
+    if(c.on_block) c.on_block(c.on_block_data, 0, 0, b.w, b.h);
+
+    tile_queue_free(q);
+    scene_image_close(im);
+    free(pids);
+
+    return failed;
+}
+
+#endif /* PROC_H */
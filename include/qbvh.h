@@ -0,0 +1,399 @@
+#ifndef QBVH_H
+#define QBVH_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<assert.h>
+#include<float.h>
+#include<math.h>
+
+#include "geom.h"
+#include "intrs.h"
+#include "numa.h"
+
+#define QBVH_LEAF 0x80000000u
+
+//
+// `QBVH` declaration, a `BVH` whose child bounds are quantized against their parent's
+
+// A child reference with `QBVH_LEAF` set indexes `leaves`, otherwise it indexes the nodes
+typedef struct QBVHLeaf {
+    unsigned first;
+    unsigned count;
+} QBVHLeaf;
+
+// Per child, the low then high grid coordinate on each axis
+typedef struct QBVHNode8 {
+    unsigned child[2];
+    unsigned char q[2][6];
+} QBVHNode8;
+
+typedef struct QBVHNode16 {
+    unsigned child[2];
+    unsigned short q[2][6];
+} QBVHNode16;
+
+// Only the root bounds are stored at full precision, every other box is decoded
+// during traversal from its parent's decoded box, so boxes only ever grow
+// Replicas live in a single NUMA arena of `arena` bytes, which is 0 otherwise
+typedef struct QBVH {
+    size_t bits;
+    Vec minima;
+    Vec maxima;
+    unsigned root;
+    size_t nc;
+    size_t lc;
+    size_t rc;
+    union {
+        QBVHNode8* n8;
+        QBVHNode16* n16;
+    };
+    QBVHLeaf* leaves;
+    Surface* items;
+    size_t arena;
+} QBVH;
+
+//
+// Helper functions
+
+double helper_qbvh_decode(unsigned q, double lo, double extent, unsigned levels) {
+    return lo + extent * (double) q / (double) levels;
+}
+
+// Rounds down for low bounds and up for high bounds, so the decoded box always
+// contains the exact one
+unsigned helper_qbvh_encode(double v, double lo, double extent, unsigned levels, int up) {
+    if(extent <= 0.) return 0;
+
+    double k = (v - lo) / extent * (double) levels;
+    k = (up) ? ceil(k) : floor(k);
+
+    unsigned q = (unsigned) MIN((double) levels, MAX(0., k));
+
+    // The division above may round the wrong way by an ulp
+    while(!up && q > 0 && helper_qbvh_decode(q, lo, extent, levels) > v) q--;
+    while(up && q < levels && helper_qbvh_decode(q, lo, extent, levels) < v) q++;
+
+    return q;
+}
+
+unsigned* helper_qbvh_quanta(QBVH* q, unsigned node, size_t side, unsigned* out) {
+    size_t i;
+    for(i = 0; i < 6; i++)
+        out[i] = (q->bits == 8) ? q->n8[node].q[side][i] : q->n16[node].q[side][i];
+
+    return out;
+}
+
+unsigned* helper_qbvh_children(QBVH* q, unsigned node) {
+    return (q->bits == 8) ? q->n8[node].child : q->n16[node].child;
+}
+
+// Decodes the box of child `side` of `node` from the node's own box
+void helper_qbvh_child_box(QBVH* q, unsigned node, size_t side, Vec minima, Vec maxima, Vec* c_min, Vec* c_max) {
+    unsigned levels = (1u << q->bits) - 1;
+
+    unsigned k[6];
+    helper_qbvh_quanta(q, node, side, k);
+
+    Vec ext = sub_vv(maxima, minima);
+
+    *c_min = (Vec) {
+        helper_qbvh_decode(k[0], minima.x, ext.x, levels),
+        helper_qbvh_decode(k[1], minima.y, ext.y, levels),
+        helper_qbvh_decode(k[2], minima.z, ext.z, levels)
+    };
+
+    *c_max = (Vec) {
+        helper_qbvh_decode(k[3], minima.x, ext.x, levels),
+        helper_qbvh_decode(k[4], minima.y, ext.y, levels),
+        helper_qbvh_decode(k[5], minima.z, ext.z, levels)
+    };
+}
+
+void helper_qbvh_count(BVH* h, size_t* nc, size_t* lc, size_t* rc) {
+    if(!h->l && !h->r) {
+        SLL* curr;
+        for(curr = h->surfaces; curr; curr = curr->next) (*rc)++;
+
+        (*lc)++;
+        return;
+    }
+
+    assert((h->l && h->r) && "Error: BVH node has a single child");
+
+    (*nc)++;
+
+    helper_qbvh_count(h->l, nc, lc, rc);
+    helper_qbvh_count(h->r, nc, lc, rc);
+}
+
+// Lays out the subtree in preorder, writing the exact bounds of both children of every
+// node to `boxes` and those of the subtree itself to `minima` and `maxima`
+unsigned helper_qbvh_layout(QBVH* q, BVH* h, Vec* boxes, Vec* minima, Vec* maxima) {
+    *minima = vec_aaa(DBL_MAX);
+    *maxima = vec_aaa(-1. * DBL_MAX);
+
+    if(!h->l && !h->r) {
+        QBVHLeaf* leaf = &q->leaves[q->lc];
+        leaf->first = (unsigned) q->rc;
+        leaf->count = 0;
+
+        SLL* curr;
+        for(curr = h->surfaces; curr; curr = curr->next) {
+            Surface s = *(Surface*) curr->item;
+
+            helper_bvh_surface_extrema(s, minima, maxima);
+
+            q->items[q->rc++] = s;
+            leaf->count++;
+        }
+
+        return (unsigned) q->lc++ | QBVH_LEAF;
+    }
+
+    unsigned node = (unsigned) q->nc++;
+    unsigned* child = helper_qbvh_children(q, node);
+
+    BVH* children[2] = { h->l, h->r };
+
+    size_t i;
+    for(i = 0; i < 2; i++) {
+        Vec* box = &boxes[4 * node + 2 * i];
+
+        child[i] = helper_qbvh_layout(q, children[i], boxes, &box[0], &box[1]);
+
+        helper_bvh_push_extrema(box[0], minima, maxima);
+        helper_bvh_push_extrema(box[1], minima, maxima);
+    }
+
+    return node;
+}
+
+// Quantizes both children of `node` against its decoded box, top-down
+void helper_qbvh_quantize(QBVH* q, unsigned node, Vec* boxes, Vec minima, Vec maxima) {
+    unsigned levels = (1u << q->bits) - 1;
+
+    Vec ext = sub_vv(maxima, minima);
+
+    size_t i;
+    for(i = 0; i < 2; i++) {
+        Vec* box = &boxes[4 * node + 2 * i];
+
+        unsigned k[6] = {
+            helper_qbvh_encode(box[0].x, minima.x, ext.x, levels, 0),
+            helper_qbvh_encode(box[0].y, minima.y, ext.y, levels, 0),
+            helper_qbvh_encode(box[0].z, minima.z, ext.z, levels, 0),
+            helper_qbvh_encode(box[1].x, minima.x, ext.x, levels, 1),
+            helper_qbvh_encode(box[1].y, minima.y, ext.y, levels, 1),
+            helper_qbvh_encode(box[1].z, minima.z, ext.z, levels, 1)
+        };
+
+        size_t j;
+        for(j = 0; j < 6; j++) {
+            if(q->bits == 8) q->n8[node].q[i][j] = (unsigned char) k[j];
+            else q->n16[node].q[i][j] = (unsigned short) k[j];
+        }
+
+        unsigned child = helper_qbvh_children(q, node)[i];
+        if(child & QBVH_LEAF) continue;
+
+        Vec c_min, c_max;
+        helper_qbvh_child_box(q, node, i, minima, maxima, &c_min, &c_max);
+
+        helper_qbvh_quantize(q, child, boxes, c_min, c_max);
+    }
+}
+
+//
+// `QBVH` functions
+
+// Builds a compressed copy of `h` with 8 or 16 bit child bounds, `h` is left untouched
+// Leaf surfaces are copied in leaf order, so each leaf's surfaces are contiguous
+QBVH* qbvh_new(BVH* h, size_t bits) {
+    assert((bits == 8 || bits == 16) && "Error: QBVH bounds must be 8 or 16 bits");
+
+    QBVH* q = malloc(sizeof *q);
+    q->bits = bits;
+    q->nc = 0;
+    q->lc = 0;
+    q->rc = 0;
+    q->arena = 0;
+
+    size_t nc = 0, lc = 0, rc = 0;
+    helper_qbvh_count(h, &nc, &lc, &rc);
+
+    assert(lc < QBVH_LEAF && nc < QBVH_LEAF && "Error: BVH is too large to compress");
+
+    if(bits == 8) q->n8 = malloc(MAX(1, nc) * sizeof *(q->n8));
+    else q->n16 = malloc(MAX(1, nc) * sizeof *(q->n16));
+
+    q->leaves = malloc(lc * sizeof *(q->leaves));
+    q->items = malloc(MAX(1, rc) * sizeof *(q->items));
+
+    Vec* boxes = malloc(MAX(1, 4 * nc) * sizeof *boxes);
+
+    q->root = helper_qbvh_layout(q, h, boxes, &q->minima, &q->maxima);
+
+    if(!(q->root & QBVH_LEAF)) helper_qbvh_quantize(q, q->root, boxes, q->minima, q->maxima);
+
+    free(boxes);
+
+    return q;
+}
+
+void qbvh_free(QBVH* q) {
+    if(!q) return;
+
+    if(q->arena) {
+        numa_arena_free(q, q->arena);
+        return;
+    }
+
+    if(q->bits == 8) free(q->n8);
+    else free(q->n16);
+
+    free(q->leaves);
+    free(q->items);
+    free(q);
+}
+
+size_t qbvh_bytes(QBVH* q) {
+    size_t node = (q->bits == 8) ? sizeof *(q->n8) : sizeof *(q->n16);
+
+    return sizeof *q + q->nc * node + q->lc * sizeof *(q->leaves) + q->rc * sizeof *(q->items);
+}
+
+size_t helper_qbvh_align(size_t n) {
+    return (n + 15) / 16 * 16;
+}
+
+// Copies `q` into one arena on `node`, so threads there traverse local memory only
+// The referenced surfaces are shared with `q`, returns NULL if the arena cannot be mapped
+QBVH* qbvh_replicate(QBVH* q, size_t node, int huge) {
+    size_t node_len = q->nc * ((q->bits == 8) ? sizeof *(q->n8) : sizeof *(q->n16));
+    size_t leaf_len = q->lc * sizeof *(q->leaves);
+    size_t item_len = q->rc * sizeof *(q->items);
+
+    size_t len = helper_qbvh_align(sizeof *q) + helper_qbvh_align(node_len) + 
+        helper_qbvh_align(leaf_len) + item_len;
+
+    char* arena = numa_arena(len, node, huge);
+    if(!arena) return NULL;
+
+    QBVH* r = (QBVH*) arena;
+    *r = *q;
+    r->arena = len;
+
+    char* at = arena + helper_qbvh_align(sizeof *q);
+
+    if(q->bits == 8) r->n8 = (QBVHNode8*) at;
+    else r->n16 = (QBVHNode16*) at;
+
+    memcpy(at, (q->bits == 8) ? (void*) q->n8 : (void*) q->n16, node_len);
+    at += helper_qbvh_align(node_len);
+
+    r->leaves = (QBVHLeaf*) at;
+    memcpy(at, q->leaves, leaf_len);
+    at += helper_qbvh_align(leaf_len);
+
+    r->items = (Surface*) at;
+    memcpy(at, q->items, item_len);
+
+    return r;
+}
+
+void qbvh_print_internal(QBVH* q, char* name, size_t indent) {
+    int id = 4 * (int) indent;
+
+    if(name)
+        printf("%.*s%s (qbvh) {\n", id, PADDING, name);
+    else
+        printf("%.*s qbvh {\n", id, PADDING);
+
+    printf(
+        "%.*s    bits: %u\n"
+        "%.*s    nodes: %u\n"
+        "%.*s    leaves: %u\n"
+        "%.*s    references: %u\n"
+        "%.*s    memory: %u bytes\n%.*s}\n",
+        id, PADDING, (unsigned) q->bits,
+        id, PADDING, (unsigned) q->nc,
+        id, PADDING, (unsigned) q->lc,
+        id, PADDING, (unsigned) q->rc,
+        id, PADDING, (unsigned) qbvh_bytes(q),
+        id, PADDING
+    );
+}
+
+void qbvh_print(QBVH* q) {
+    qbvh_print_internal(q, NULL, 0);
+}
+
+//
+// Traversal, mirrors `helper_bvh_intersection_entered`
+
+// Expects the ray to enter the box of `ref`, given by `minima` and `maxima`, before `t_max`
+Intersection helper_qbvh_intersection(QBVH* q, unsigned ref, Vec minima, Vec maxima, Ray r, Surface e, double t_min, double t_max) {
+    Intersection intrs_a, intrs_b;
+    intrs_a = (Intersection) {
+        .s = (Surface) { .st = NONE },
+        .t = t_max + 1.
+    };
+
+    if(ref & QBVH_LEAF) {
+        QBVHLeaf leaf = q->leaves[ref & ~QBVH_LEAF];
+
+        size_t i;
+        for(i = leaf.first; i < leaf.first + leaf.count; i++) {
+            Surface s;
+            double t = surface_intersection_excl(q->items[i], r, e, t_min, t_max, &s);
+
+            if(t < intrs_a.t) {
+                intrs_a.s = s;
+                intrs_a.t = t;
+            }
+        }
+
+        return intrs_a;
+    }
+
+    unsigned* child = helper_qbvh_children(q, ref);
+
+    Vec c_min[2], c_max[2];
+    double c_t[2];
+
+    size_t i;
+    for(i = 0; i < 2; i++) {
+        helper_qbvh_child_box(q, ref, i, minima, maxima, &c_min[i], &c_max[i]);
+        c_t[i] = helper_bvh_box_entry(c_min[i], c_max[i], r);
+    }
+
+    size_t near = (c_t[1] < c_t[0]);
+    size_t far = 1 - near;
+
+    intrs_b = intrs_a;
+
+    if(c_t[near] <= t_max) 
+        intrs_a = helper_qbvh_intersection(q, child[near], c_min[near], c_max[near], r, e, t_min, t_max);
+
+    t_max = MIN(t_max, intrs_a.t);
+    if(c_t[far] <= t_max) 
+        intrs_b = helper_qbvh_intersection(q, child[far], c_min[far], c_max[far], r, e, t_min, t_max);
+
+    return (intrs_a.t < intrs_b.t) ? intrs_a : intrs_b;
+}
+
+Intersection qbvh_intersection(QBVH* q, Ray r, Surface e, double t_min, double t_max) {
+    if(helper_bvh_box_entry(q->minima, q->maxima, r) > t_max) {
+        return (Intersection) {
+            .s = (Surface) { .st = NONE },
+            .t = t_max + 1.
+        };
+    }
+
+    return helper_qbvh_intersection(q, q->root, q->minima, q->maxima, r, e, t_min, t_max);
+}
+
+#endif /* QBVH_H */
@@ -0,0 +1,208 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<float.h>
+
+#include "intrs.h"
+
+#define REPORT_LEAF_BINS 17
+
+//
+// `BVHReport` declaration
+
+typedef struct BVHReport {
+    size_t nodes;
+    size_t leaves;
+    size_t refs;
+    size_t depth_max;
+    size_t* depths;
+    size_t leaf_sizes[REPORT_LEAF_BINS];
+    size_t leaf_max;
+    double sah;
+    double overlap;
+    double overlap_max;
+    size_t bytes;
+} BVHReport;
+
+void bvh_report_free(BVHReport* rep) {
+    free(rep->depths);
+}
+
+//
+// Helper functions
+
+void helper_bvh_report_walk(BVHReport* rep, BVH* h, size_t depth, double root_area) {
+    rep->nodes++;
+    rep->bytes += sizeof *h;
+
+    if(depth + 1 > rep->depth_max) {
+        rep->depths = realloc(rep->depths, (depth + 1) * sizeof *(rep->depths));
+
+        size_t i;
+        for(i = rep->depth_max; i <= depth; i++) rep->depths[i] = 0;
+
+        rep->depth_max = depth + 1;
+    }
+
+    double area = helper_bvh_area(h->minima, h->maxima) / root_area;
+
+    if(!h->l && !h->r) {
+        size_t count = 0;
+
+        SLL* curr;
+        for(curr = h->surfaces; curr; curr = curr->next) count++;
+
+        rep->leaves++;
+        rep->refs += count;
+        rep->bytes += count * sizeof(SLL);
+        rep->depths[depth]++;
+        rep->leaf_sizes[MIN(count, REPORT_LEAF_BINS - 1)]++;
+        rep->leaf_max = MAX(rep->leaf_max, count);
+        rep->sah += SAH_INTERSECT * area * (double) count;
+
+        return;
+    }
+
+    rep->sah += SAH_TRAVERSAL * area;
+
+    if(h->l && h->r) {
+        Vec mn = (Vec) {
+            MAX(h->l->minima.x, h->r->minima.x),
+            MAX(h->l->minima.y, h->r->minima.y),
+            MAX(h->l->minima.z, h->r->minima.z)
+        };
+
+        Vec mx = (Vec) {
+            MIN(h->l->maxima.x, h->r->maxima.x),
+            MIN(h->l->maxima.y, h->r->maxima.y),
+            MIN(h->l->maxima.z, h->r->maxima.z)
+        };
+
+        // Overlap is measured relative to the parent's surface area
+        double overlap = helper_bvh_area(mn, mx);
+        double parent = helper_bvh_area(h->minima, h->maxima);
+
+        if(parent > 0.) {
+            rep->overlap += overlap / parent;
+            rep->overlap_max = MAX(rep->overlap_max, overlap / parent);
+        }
+    }
+
+    if(h->l) helper_bvh_report_walk(rep, h->l, depth + 1, root_area);
+    if(h->r) helper_bvh_report_walk(rep, h->r, depth + 1, root_area);
+}
+
+//
+// `BVHReport` creation
+
+BVHReport bvh_report(BVH* h) {
+    assert(h && "Error: Unable to report on an uninitialized BVH");
+
+    BVHReport rep;
+    memset(&rep, 0, sizeof rep);
+
+    double root_area = helper_bvh_area(h->minima, h->maxima);
+    if(root_area <= 0.) root_area = 1.;
+
+    helper_bvh_report_walk(&rep, h, 0, root_area);
+
+    size_t interior = rep.nodes - rep.leaves;
+    if(interior) rep.overlap /= (double) interior;
+
+    return rep;
+}
+
+//
+// `BVHReport` output
+
+void bvh_report_print_internal(BVHReport* rep, char* name, size_t indent) {
+    int id = 4 * (int) indent;
+
+    if(name)
+        printf("%.*s%s (report) {\n", id, PADDING, name);
+    else
+        printf("%.*s report {\n", id, PADDING);
+
+    printf(
+        "%.*s    nodes: %u\n"
+        "%.*s    leaves: %u\n"
+        "%.*s    references: %u\n"
+        "%.*s    sah cost: %.4lf\n"
+        "%.*s    sibling overlap (mean): %.4lf\n"
+        "%.*s    sibling overlap (max): %.4lf\n"
+        "%.*s    memory: %u bytes\n",
+        id, PADDING, (unsigned) rep->nodes,
+        id, PADDING, (unsigned) rep->leaves,
+        id, PADDING, (unsigned) rep->refs,
+        id, PADDING, rep->sah,
+        id, PADDING, rep->overlap,
+        id, PADDING, rep->overlap_max,
+        id, PADDING, (unsigned) rep->bytes
+    );
+
+    size_t i;
+
+    printf("%.*s    leaves per depth {\n", id, PADDING);
+    for(i = 0; i < rep->depth_max; i++)
+        if(rep->depths[i])
+            printf("%.*s        %u: %u\n", id, PADDING, (unsigned) i, (unsigned) rep->depths[i]);
+    printf("%.*s    }\n", id, PADDING);
+
+    printf("%.*s    leaf sizes {\n", id, PADDING);
+    for(i = 0; i < REPORT_LEAF_BINS; i++) {
+        if(!rep->leaf_sizes[i]) continue;
+
+        printf(
+            "%.*s        %u%s: %u\n",
+            id, PADDING, (unsigned) i,
+            (i == REPORT_LEAF_BINS - 1) ? "+" : "",
+            (unsigned) rep->leaf_sizes[i]
+        );
+    }
+    printf("%.*s    }\n", id, PADDING);
+
+    printf(
+        "%.*s    largest leaf: %u\n%.*s}\n",
+        id, PADDING, (unsigned) rep->leaf_max,
+        id, PADDING
+    );
+}
+
+void bvh_report_print(BVHReport* rep) {
+    bvh_report_print_internal(rep, NULL, 0);
+}
+
+//
+// Compare two `BVHStrategy`s over the same set of surfaces
+
+void bvh_report_compare(size_t sc, Surface* surfaces, BVHStrategy a, BVHStrategy b) {
+    char* names[] = { "MIDPOINT", "SAH", "SBVH" };
+
+    BVH* ha = bvh_initialize_strategy(sc, surfaces, a);
+    BVH* hb = bvh_initialize_strategy(sc, surfaces, b);
+
+    BVHReport ra = bvh_report(ha);
+    BVHReport rb = bvh_report(hb);
+
+    printf("comparison {\n");
+
+    bvh_report_print_internal(&ra, names[a], 1);
+    bvh_report_print_internal(&rb, names[b], 1);
+
+    printf(
+        "    sah ratio (%s / %s): %.4lf\n"
+        "    memory ratio (%s / %s): %.4lf\n}\n",
+        names[b], names[a], rb.sah / ra.sah,
+        names[b], names[a], (double) rb.bytes / (double) ra.bytes
+    );
+
+    bvh_report_free(&ra);
+    bvh_report_free(&rb);
+
+    bvh_free(ha);
+    bvh_free(hb);
+}
+
+#endif /* REPORT_H */
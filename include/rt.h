@@ -7,6 +7,7 @@
 #include "buffer.h"
 #include "in.h"
 #include "intrs.h"
+#include "report.h"
 #include "scene.h"
 
 // TODO: Remove test function once Rust FFI is stable
@@ -15,14 +16,15 @@ int test(void) { return 1; }
 //
 // Raytracing
 
-Ray camera_ray(Scene s, size_t h, size_t w, size_t x, size_t y) {
+// Takes continuous image coordinates so rays can be jittered within a pixel
+Ray camera_ray_at(Scene s, size_t h, size_t w, double x, double y) {
     Vec camera_dir = norm_v(sub_vv(s.camera.at, s.camera.pos));
 
     Vec up = vec_abc(0., -1., 0.);
     Vec right = cross_vv(camera_dir, up);
 
-    double norm_x = ((double) x / (double) w) - 0.5;
-    double norm_y = ((double) y / (double) h) - 0.5;
+    double norm_x = (x / (double) w) - 0.5;
+    double norm_y = (y / (double) h) - 0.5;
 
     Vec i = mul_vs(right, norm_x);
     Vec j = mul_vs(up, norm_y);
@@ -35,56 +37,280 @@ Ray camera_ray(Scene s, size_t h, size_t w, size_t x, size_t y) {
     };
 }
 
-Vec cast(Scene s, Config c, size_t h, size_t w, size_t x, size_t y) {
-    Ray r = camera_ray(s, h, w, x, y);
+Ray camera_ray(Scene s, size_t h, size_t w, size_t x, size_t y) {
+    return camera_ray_at(s, h, w, (double) x, (double) y);
+}
+
+// Inverse of `camera_ray_at`, writes the image coordinates of `p` to `x` and `y`
+// Returns 0 if `p` is not in front of the camera
+int camera_project(Scene s, size_t h, size_t w, Vec p, double* x, double* y) {
+    Vec camera_dir = norm_v(sub_vv(s.camera.at, s.camera.pos));
+
+    Vec up = vec_abc(0., -1., 0.);
+    Vec right = cross_vv(camera_dir, up);
+
+    // Solve `v = a * camera_dir + b * right + c * up` with Cramer's rule
+    Vec v = sub_vv(p, s.camera.pos);
+
+    double det = dot_vv(camera_dir, cross_vv(right, up));
+    if(fabs(det) < EPS_TRI) return 0;
+
+    double a = dot_vv(v, cross_vv(right, up)) / det;
+    double b = dot_vv(camera_dir, cross_vv(v, up)) / det;
+    double c = dot_vv(camera_dir, cross_vv(right, v)) / det;
+
+    if(a <= EPS_TRI) return 0;
+
+    *x = (b / a + 0.5) * (double) w;
+    *y = (c / a + 0.5) * (double) h;
+
+    return 1;
+}
+
+// Diffuse and specular contribution of a single unoccluded `Light`
+Vec helper_cast_light(Material* material, Ray r, Vec normal, Light light, Ray light_ray) {
+    double diffuse = MAX(0., dot_vv(normal, light_ray.dir) * light.strength);
 
-    Intersection intrs = intersection_check(s, c, r);
-    if(!intrs.s.st) return vec_aaa(0.);
+    Vec color = mul_vs(material->color_diffuse, diffuse);
 
-    Vec normal, hit;
-    intersection_normal(intrs, r, &normal, &hit);
+    Vec refl = sub_vv(r.dir, mul_vs(normal, 2. * dot_vv(normal, r.dir)));
 
+    double spec = MAX(0., material->luster * pow(dot_vv(refl, light_ray.dir), material->metallicity));
+
+    return add_vv(color, mul_vs(material->color_spec, spec));
+}
+
+// Contribution of `light`, scaled by `weight`, unless it is shadowed at `hit`
+Vec helper_cast_shadowed(Scene s, Config c, Ray r, Intersection intrs, Vec normal, Vec hit, Light* light, double weight) {
+    Ray light_ray = (Ray) {
+        .origin = hit,
+        .dir = norm_v(sub_vv(light->pos, hit))
+    };
+
+    if(shadow_check_excl(s, c, light_ray, intrs.s, light)) return vec_aaa(0.);
+
+    return mul_vs(helper_cast_light(intersection_material(intrs), r, normal, *light, light_ray), weight);
+}
+
+// Unclamped ambient, diffuse and specular contribution of the lights reaching `hit`
+// When more than `c.light_samples` lights reach it, that many are drawn instead with
+// probability proportional to their attenuated strength (requires an `Rng`)
+Vec helper_cast_local(Scene s, Config c, Ray r, Intersection intrs, Vec normal, Vec hit, Rng* rng) {
     Material* material = intersection_material(intrs);
 
     Vec pixel_color = mul_vs(material->color_ambient, c.ambience);
-    SLL* curr = s.lights; while(curr) {
-        Light light = *(Light*) curr->item;
 
-        Ray light_ray = (Ray) {
-            .origin = hit,
-            .dir = norm_v(sub_vv(light.pos, hit))
-        };
-        
-        Intersection shadow = intersection_check_excl(s, c, light_ray, intrs.s);
-        if(!shadow.s.st) {
-            double diffuse = MAX(0., dot_vv(normal, light_ray.dir) * light.strength);
+    Light** ls;
+    size_t k, lc = light_grid_query(s.lg, hit, &ls);
+
+    if(!rng || !c.light_samples || lc <= c.light_samples) {
+        for(k = 0; k < lc; k++) {
+            double a = light_attenuation(ls[k], hit);
+            if(a <= 0.) continue;
+
+            pixel_color = add_vv(pixel_color, 
+                helper_cast_shadowed(s, c, r, intrs, normal, hit, ls[k], a));
+        }
+
+        return pixel_color;
+    }
+
+    double total = 0.;
+    for(k = 0; k < lc; k++) total += ls[k]->strength * light_attenuation(ls[k], hit);
+
+    if(total <= 0.) return pixel_color;
 
-            pixel_color = add_vv(pixel_color, mul_vs(material->color_diffuse, diffuse));
+    size_t n;
+    for(n = 0; n < c.light_samples; n++) {
+        double u = rng_next(rng) * total;
 
-            Vec refl = sub_vv(r.dir, mul_vs(normal, 2. * dot_vv(normal, r.dir)));
+        double a = 0., p = 0.;
+        for(k = 0; k < lc; k++) {
+            a = light_attenuation(ls[k], hit);
+            p = ls[k]->strength * a;
 
-            double spec = MAX(0., material->luster * pow(dot_vv(refl, light_ray.dir), material->metallicity));
+            if(u < p || k + 1 == lc) break;
+            u -= p;
+        }
+
+        if(p <= 0.) continue;
+
+        // Each sample stands in for `total / p` of the lights' combined strength
+        double weight = a * total / (p * (double) c.light_samples);
+
+        pixel_color = add_vv(pixel_color, 
+            helper_cast_shadowed(s, c, r, intrs, normal, hit, ls[k], weight));
+    }
+
+    return pixel_color;
+}
+
+//
+// `PathRay` declaration, a pending secondary ray and the weight it carries
+
+#define PATH_STACK 64
+
+typedef struct PathRay {
+    Ray r;
+    Vec weight;
+    size_t depth;
+    Surface excl;
+} PathRay;
+
+// Returns 0 if the ray's weight falls below `c.min_weight` or it loses the russian
+// roulette, which only starts once `c.rr_depth` bounces have been taken
+int helper_cast_survives(Config c, Rng* rng, PathRay* pr) {
+    double importance = MAX(pr->weight.x, MAX(pr->weight.y, pr->weight.z));
+    if(importance <= 0. || importance < c.min_weight) return 0;
+
+    if(rng && c.rr_depth && pr->depth >= c.rr_depth) {
+        double survival = MIN(1., MAX(0.05, importance));
+        if(rng_next(rng) >= survival) return 0;
+
+        pr->weight = div_vs(pr->weight, survival);
+    }
+
+    return 1;
+}
 
-            pixel_color = add_vv(pixel_color, mul_vs(material->color_spec, spec));
+// Fraction of the local shading kept at a hit, the rest is carried by its bounces
+Vec helper_cast_retained(PathRay pr, Material* material) {
+    return mul_vs(pr.weight, 1. - material->reflectivity - material->transparency);
+}
+
+// Writes the reflected and refracted continuations of `pr` into `out`
+// Returns the number of rays written, at most 2
+size_t helper_cast_bounce(Config c, PathRay pr, Intersection intrs, Vec normal, Vec hit, PathRay* out) {
+    Material* material = intersection_material(intrs);
+
+    double kr = material->reflectivity;
+    double kt = material->transparency;
+
+    if(pr.depth >= c.max_depth || (kr <= 0. && kt <= 0.)) return 0;
+
+    Vec n = norm_v(normal);
+    double cos_i = dot_vv(n, pr.r.dir);
+
+    // A ray reflected from inside a surface can only hit that surface next, so it is
+    // only excluded for reflections off the front face, relying on `c.t_min` otherwise
+    Surface excl = (cos_i < 0.) ? intrs.s : (Surface) { .st = NONE };
+
+    size_t count = 0;
+
+    // Refraction falls back to reflection under total internal reflection
+    if(kt > 0.) {
+        double eta = (material->ior > 0.) ? material->ior : 1.;
+        
+        Vec nt = n;
+        if(cos_i < 0.) {
+            eta = 1. / eta;
+            cos_i = -1. * cos_i;
+        } else nt = mul_vs(n, -1.);
+
+        double k = 1. - eta * eta * (1. - cos_i * cos_i);
+        if(k < 0.) kr += kt;
+        else {
+            Vec dir = add_vv(mul_vs(pr.r.dir, eta), mul_vs(nt, eta * cos_i - sqrt(k)));
+
+            out[count++] = (PathRay) {
+                .r = (Ray) { .origin = hit, .dir = norm_v(dir) },
+                .weight = mul_vs(pr.weight, kt),
+                .depth = pr.depth + 1,
+                .excl = (Surface) { .st = NONE }
+            };
         }
+    }
+
+    if(kr > 0.) {
+        Vec dir = sub_vv(pr.r.dir, mul_vs(n, 2. * dot_vv(n, pr.r.dir)));
+
+        out[count++] = (PathRay) {
+            .r = (Ray) { .origin = hit, .dir = norm_v(dir) },
+            .weight = mul_vs(pr.weight, kr),
+            .depth = pr.depth + 1,
+            .excl = excl
+        };
+    }
+
+    return count;
+}
 
-        curr = curr->next;
+// Shades `r` along with up to `c.max_depth` bounces of reflection and refraction
+// The bounces are kept on an explicit stack rather than recursing
+// Also reports the primary `Intersection` through `primary` when it is non-null
+Vec cast_ray_primary(Scene s, Config c, Ray r, Rng* rng, Intersection* primary) {
+    PathRay stack[PATH_STACK];
+    size_t sc = 0;
+
+    stack[sc++] = (PathRay) {
+        .r = r,
+        .weight = vec_aaa(1.),
+        .depth = 0,
+        .excl = (Surface) { .st = NONE }
+    };
+
+    Vec pixel_color = vec_aaa(0.);
+    while(sc) {
+        PathRay pr = stack[--sc];
+
+        Intersection intrs = intersection_check_excl(s, c, pr.r, pr.excl);
+        if(primary && !pr.depth) *primary = intrs;
+
+        if(!intrs.s.st) continue;
+
+        Vec normal, hit;
+        intersection_normal(intrs, pr.r, &normal, &hit);
+
+        Vec local = helper_cast_local(s, c, pr.r, intrs, normal, hit, rng);
+        Vec retained = helper_cast_retained(pr, intersection_material(intrs));
+
+        pixel_color = add_vv(pixel_color, (Vec) {
+            retained.x * local.x,
+            retained.y * local.y,
+            retained.z * local.z
+        });
+
+        PathRay bounces[2];
+
+        size_t i, bc = helper_cast_bounce(c, pr, intrs, normal, hit, bounces);
+        for(i = 0; i < bc; i++)
+            if(sc < PATH_STACK && helper_cast_survives(c, rng, &bounces[i]))
+                stack[sc++] = bounces[i];
     }
 
     return clamp_v(pixel_color, 0., 1.);
 }
 
+Vec cast_ray(Scene s, Config c, Ray r, Rng* rng) {
+    return cast_ray_primary(s, c, r, rng, NULL);
+}
+
+Vec cast(Scene s, Config c, size_t h, size_t w, size_t x, size_t y) {
+    Rng rng = rng_seed(x + y * w);
+
+    return cast_ray(s, c, camera_ray(s, h, w, x, y), &rng);
+}
+
 // 
 // Single-thraded `raytrace` function
 
+// `c.on_block`, when set, is called after each completed row
 void helper_raytrace_standard(Buffer b, Scene s, Config c) {
+    ShadowCache cache = shadow_cache_new();
+    c.shadow_cache = &cache;
+
     size_t x, y;
-    for(x = 0; x < b.w; x++)
-        for(y = 0; y < b.h; y++) {
+    for(y = 0; y < b.h; y++) {
+        for(x = 0; x < b.w; x++) {
             Vec color = cast(s, c, b.h, b.w, x, y);
 
             buffer_set_pixel(b, x, y, color);
         }
+
+        if(c.on_block) c.on_block(c.on_block_data, 0, y, b.w, 1);
+    }
+
+    shadow_cache_merge(&cache, c.shadow_stats);
 }
 
 //
@@ -98,6 +324,26 @@ typedef struct Block {
     size_t y_end;
 } Block;
 
+// Renders a `Block` row by row into the thread's own `tile`, then copies it out at once
+// Keeping writes off the shared `Buffer` avoids false sharing at block edges
+// `c.on_block`, when set, is called once the block is in the `Buffer`
+void helper_raytrace_block(Buffer b, Scene s, Config c, Block blk, char* tile) {
+    size_t tw = blk.x_end - blk.x_start;
+    size_t th = blk.y_end - blk.y_start;
+
+    size_t x, y;
+    for(y = 0; y < th; y++)
+        for(x = 0; x < tw; x++) {
+            Vec color = cast(s, c, b.h, b.w, blk.x_start + x, blk.y_start + y);
+
+            buffer_pack_pixel(tile + 3 * (x + y * tw), color);
+        }
+
+    buffer_write_tile(b, blk.x_start, blk.y_start, tw, th, tile);
+
+    if(c.on_block) c.on_block(c.on_block_data, blk.x_start, blk.y_start, tw, th);
+}
+
 // Used to dispatch the next `Block` to a waiting thread
 Block next_block(size_t* index, size_t block_w, size_t block_h, size_t block_size) {
     if(*index >= block_w * block_h)
@@ -126,42 +372,479 @@ void helper_raytrace_omp(Buffer b, Scene s, Config c) {
     size_t block_w = b.w / block_size;
     size_t block_h = b.h / block_size;
 
-    omp_set_dynamic(0);
-    omp_set_num_threads(c.threads);
-
     omp_lock_t lock;
     omp_init_lock(&lock);
 
     size_t i = 0;
-    #pragma omp parallel
+    #pragma omp parallel num_threads(config_threads(c))
     {
+        char* tile = malloc(3 * block_size * block_size);
+
+        ShadowCache cache = shadow_cache_new();
+
+        Config tc = c;
+        tc.shadow_cache = &cache;
+
+        Scene ts = scene_local(s);
+
         omp_set_lock(&lock);
         Block curr = next_block(&i, block_w, block_h, block_size);
         omp_unset_lock(&lock);
 
-        size_t x, y;
         while(!curr.final) {
-            for(x = curr.x_start; x < curr.x_end; x++) {
-                for(y = curr.y_start; y < curr.y_end; y++) {
-                    Vec color = cast(s, c, b.h, b.w, x, y);
+            helper_raytrace_block(b, ts, tc, curr, tile);
 
-                    buffer_set_pixel(b, x, y, color);
-                }
+            omp_set_lock(&lock);
+            curr = next_block(&i, block_w, block_h, block_size);
+            omp_unset_lock(&lock);
+        }
+
+        shadow_cache_merge(&cache, c.shadow_stats);
+
+        free(tile);
+    }
+
+    omp_destroy_lock(&lock);
+}
+
+// Renders the `Block`s in list order, writing the time each one took to `times` if set
+void helper_raytrace_blocks_timed(Buffer b, Scene s, Config c, Block* blocks, size_t bc, double* times) {
+    assert(s.tt && "Error: Scene was not initialized");
+
+    omp_lock_t lock;
+    omp_init_lock(&lock);
+
+    size_t i = 0;
+    #pragma omp parallel num_threads(config_threads(c))
+    {
+        char* tile = NULL;
+        size_t tile_len = 0;
+
+        ShadowCache cache = shadow_cache_new();
+
+        Config tc = c;
+        tc.shadow_cache = &cache;
+
+        Scene ts = scene_local(s);
+
+        for(;;) {
+            omp_set_lock(&lock);
+            size_t k = i++;
+            omp_unset_lock(&lock);
+
+            if(k >= bc) break;
+
+            Block blk = blocks[k];
+
+            size_t len = 3 * (blk.x_end - blk.x_start) * (blk.y_end - blk.y_start);
+            if(len > tile_len) {
+                tile = realloc(tile, len);
+                tile_len = len;
             }
 
+            double start = (times) ? omp_get_wtime() : 0.;
+
+            helper_raytrace_block(b, ts, tc, blk, tile);
+
+            if(times) times[k] = omp_get_wtime() - start;
+        }
+
+        shadow_cache_merge(&cache, c.shadow_stats);
+
+        free(tile);
+    }
+
+    omp_destroy_lock(&lock);
+}
+
+// Renders only the given `Block`s, which may differ in size, handing them out in list order
+void raytrace_blocks(Buffer b, Scene s, Config c, Block* blocks, size_t bc) {
+    helper_raytrace_blocks_timed(b, s, c, blocks, bc, NULL);
+}
+
+//
+// Cost-predictive scheduling
+
+#define TILE_SPLIT 4
+#define TILE_MIN 4
+
+// Seconds each `Block` of the image took on the last frame, or an estimate from a
+// sparse pre-pass before the first one. Declared in scene.h for `Config.tile_costs`
+struct TileCosts {
+    size_t block_size;
+    size_t block_w;
+    size_t block_h;
+    double* costs;
+    int measured;
+};
+
+typedef struct CostedBlock {
+    Block blk;
+    size_t tile;
+    double cost;
+} CostedBlock;
+
+TileCosts tile_costs_new(Buffer b, Config c) {
+    assert((b.w % c.block_size == 0 && b.h % c.block_size == 0) &&
+        "Error: Image dimensions must be cleanly divisible by block size");
+
+    TileCosts init = (TileCosts) {
+        .block_size = c.block_size,
+        .block_w = b.w / c.block_size,
+        .block_h = b.h / c.block_size,
+        .costs = NULL,
+        .measured = 0
+    };
+
+    init.costs = calloc(init.block_w * init.block_h, sizeof *(init.costs));
+
+    return init;
+}
+
+void tile_costs_free(TileCosts* tc) {
+    free(tc->costs);
+}
+
+// Returns 1 if the costs were made for a `Buffer` of `b`'s size and `c`'s block size
+int tile_costs_fit(TileCosts* tc, Buffer b, Config c) {
+    return tc->block_size == c.block_size &&
+        b.w == tc->block_w * tc->block_size && b.h == tc->block_h * tc->block_size;
+}
+
+// Times a 2 x 2 grid of primary rays in every `Block`, scaled up to the whole block
+void helper_tile_costs_probe(TileCosts* tc, Buffer b, Scene s, Config c) {
+    size_t bs = tc->block_size;
+    long i;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(config_threads(c))
+    for(i = 0; i < (long) (tc->block_w * tc->block_h); i++) {
+        size_t x0 = (size_t) i % tc->block_w * bs;
+        size_t y0 = (size_t) i / tc->block_w * bs;
+
+        double start = omp_get_wtime();
+
+        size_t j;
+        for(j = 0; j < 4; j++) cast(s, c, b.h, b.w, x0 + (2 * (j % 2) + 1) * bs / 4, y0 + (2 * (j / 2) + 1) * bs / 4);
+
+        tc->costs[i] = (omp_get_wtime() - start) * (double) (bs * bs) / 4.;
+    }
+}
+
+int helper_tile_costs_cmp(const void* a, const void* b) {
+    double ca = ((CostedBlock*) a)->cost;
+    double cb = ((CostedBlock*) b)->cost;
+
+    return (ca < cb) - (ca > cb);
+}
+
+// Lists the `Block`s most expensive first, splitting any expected to take more than
+// 1 / (TILE_SPLIT * threads) of the frame into quarters so it cannot end up last alone
+size_t helper_tile_costs_schedule(TileCosts* tc, size_t threads, CostedBlock* out) {
+    size_t tiles = tc->block_w * tc->block_h;
+    size_t bs = tc->block_size;
+
+    double total = 0.;
+
+    size_t i;
+    for(i = 0; i < tiles; i++) total += tc->costs[i];
+
+    double limit = total / (double) (TILE_SPLIT * threads);
+
+    size_t n = 0;
+    for(i = 0; i < tiles; i++) {
+        Block blk = (Block) {
+            .final = 0,
+            .x_start = i % tc->block_w * bs,
+            .x_end = i % tc->block_w * bs + bs,
+            .y_start = i / tc->block_w * bs,
+            .y_end = i / tc->block_w * bs + bs
+        };
+
+        if(tc->costs[i] <= limit || bs < 2 * TILE_MIN) {
+            out[n++] = (CostedBlock) { .blk = blk, .tile = i, .cost = tc->costs[i] };
+            continue;
+        }
+
+        size_t xm = blk.x_start + bs / 2;
+        size_t ym = blk.y_start + bs / 2;
+
+        size_t q;
+        for(q = 0; q < 4; q++) {
+            Block part = blk;
+
+            if(q % 2) part.x_start = xm;
+            else part.x_end = xm;
+
+            if(q / 2) part.y_start = ym;
+            else part.y_end = ym;
+
+            out[n++] = (CostedBlock) { .blk = part, .tile = i, .cost = tc->costs[i] / 4. };
+        }
+    }
+
+    qsort(out, n, sizeof *out, helper_tile_costs_cmp);
+
+    return n;
+}
+
+// Renders the frame most expensive `Block`s first, by the costs of the last frame (or a
+// sparse pre-pass on the first), then records this frame's costs for the next one
+void raytrace_scheduled(Buffer b, Scene s, Config c, TileCosts* tc) {
+    assert(s.tt && "Error: Scene was not initialized");
+    assert(tile_costs_fit(tc, b, c) &&
+        "Error: TileCosts were made for a Buffer of a different size");
+
+    if(!tc->measured) helper_tile_costs_probe(tc, b, s, c);
+
+    size_t tiles = tc->block_w * tc->block_h;
+
+    CostedBlock* order = malloc(4 * MAX(1, tiles) * sizeof *order);
+    size_t n = helper_tile_costs_schedule(tc, config_threads(c), order);
+
+    Block* blocks = malloc(MAX(1, n) * sizeof *blocks);
+    double* times = malloc(MAX(1, n) * sizeof *times);
+
+    size_t i;
+    for(i = 0; i < n; i++) blocks[i] = order[i].blk;
+
+    helper_raytrace_blocks_timed(b, s, c, blocks, n, times);
+
+    memset(tc->costs, 0, tiles * sizeof *(tc->costs));
+    for(i = 0; i < n; i++) tc->costs[order[i].tile] += times[i];
+
+    tc->measured = 1;
+
+    free(order);
+    free(blocks);
+    free(times);
+}
+
+//
+// `View` declaration, one camera and the `Buffer` it renders into
+
+typedef struct View {
+    Camera camera;
+    Buffer b;
+} View;
+
+// Renders every `View` of a single `Scene` from one shared queue of `Block`s
+// Threads move straight on to the next view's blocks instead of joining between views
+void raytrace_views(View* vs, size_t vc, Scene s, Config c) {
+    assert(s.tt && "Error: Scene was not initialized");
+
+    size_t block_size = c.block_size;
+
+    Scene* scenes = malloc(MAX(1, vc) * sizeof *scenes);
+    size_t* offsets = malloc((vc + 1) * sizeof *offsets);
+
+    offsets[0] = 0;
+
+    size_t v;
+    for(v = 0; v < vc; v++) {
+        Buffer b = vs[v].b;
+
+        assert((b.w % block_size == 0 && b.h % block_size == 0) &&
+            "Error: Image dimensions must be cleanly divisible by block size");
+
+        scenes[v] = s;
+        scenes[v].camera = vs[v].camera;
+
+        offsets[v + 1] = offsets[v] + (b.w / block_size) * (b.h / block_size);
+    }
+
+    omp_lock_t lock;
+    omp_init_lock(&lock);
+
+    size_t i = 0;
+    #pragma omp parallel num_threads(config_threads(c))
+    {
+        char* tile = malloc(3 * block_size * block_size);
+
+        ShadowCache cache = shadow_cache_new();
+
+        Config tc = c;
+        tc.shadow_cache = &cache;
+
+        // Views are handed out in order, so each thread picks its replica once per view
+        size_t view = 0;
+        Scene ts = scene_local(scenes[view]);
+
+        for(;;) {
             omp_set_lock(&lock);
-            curr = next_block(&i, block_w, block_h, block_size);
+            size_t k = i++;
             omp_unset_lock(&lock);
+
+            if(k >= offsets[vc]) break;
+
+            if(k >= offsets[view + 1]) {
+                while(k >= offsets[view + 1]) view++;
+
+                ts = scene_local(scenes[view]);
+            }
+
+            Buffer b = vs[view].b;
+
+            size_t index = k - offsets[view];
+            Block curr = next_block(&index, b.w / block_size, b.h / block_size, block_size);
+
+            helper_raytrace_block(b, ts, tc, curr, tile);
+        }
+
+        shadow_cache_merge(&cache, c.shadow_stats);
+
+        free(tile);
+    }
+
+    omp_destroy_lock(&lock);
+
+    free(scenes);
+    free(offsets);
+}
+
+//
+// Progressive rendering into an `Accum`
+
+#define PROGRESSIVE_MAX_PASSES 4096
+
+// Adds one sample to every pixel, the first pass is unjittered so it matches `raytrace`
+void raytrace_pass(Accum a, Scene s, Config c, size_t pass) {
+    long y;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(config_threads(c))
+    for(y = 0; y < (long) a.h; y++) {
+        size_t x;
+        for(x = 0; x < a.w; x++) {
+            Rng rng = rng_seed((pass * a.h + (size_t) y) * a.w + x);
+
+            double jx = 0., jy = 0.;
+            if(pass) {
+                jx = rng_next(&rng);
+                jy = rng_next(&rng);
+            }
+
+            Ray r = camera_ray_at(s, a.h, a.w, (double) x + jx, (double) y + jy);
+
+            accum_add_sample(a, x, (size_t) y, cast_ray(s, c, r, &rng));
         }
     }
 }
 
-// Combined `raytrace` function
+// Renders passes until `budget` seconds elapse or the noise estimate falls below `noise`
+// Either limit is ignored when it is 0, and no more than PROGRESSIVE_MAX_PASSES are
+// accumulated in any case, since the estimate may never reach `noise`
+// Returns the total number of passes accumulated
+size_t raytrace_progressive(Accum a, Scene s, Config c, double budget, double noise) {
+    assert(s.tt && "Error: Scene was not initialized");
+    assert((budget > 0. || noise > 0.) &&
+        "Error: Progressive rendering requires a time budget or noise threshold");
+
+    double start = omp_get_wtime();
+
+    size_t pass = a.ns[0];
+    do {
+        raytrace_pass(a, s, c, pass++);
+
+        if(budget > 0. && omp_get_wtime() - start >= budget) break;
+        if(pass >= PROGRESSIVE_MAX_PASSES) break;
+    } while(!(noise > 0. && pass > 1 && accum_noise(a) < noise));
+
+    return pass;
+}
+
+//
+// Adaptive anti-aliasing
+
+// Neighbors differ if their colors, materials or depths diverge past `threshold`
+// Materials stand in for surface identity so the triangles of one mesh compare equal
+int helper_raytrace_edge(Vec* colors, Intersection* intrs, size_t i, size_t j, double threshold) {
+    Vec d = sub_vv(colors[i], colors[j]);
+    if(MAX(fabs(d.x), MAX(fabs(d.y), fabs(d.z))) > threshold) return 1;
+
+    if(!intrs[i].s.st || !intrs[j].s.st) return intrs[i].s.st != intrs[j].s.st;
+
+    if(intersection_material(intrs[i]) != intersection_material(intrs[j])) return 1;
+
+    return fabs(intrs[i].t - intrs[j].t) > threshold * MAX(intrs[i].t, intrs[j].t);
+}
+
+// Casts one ray per pixel, then up to `c.aa_samples` jittered rays where neighbors differ
+// Returns the number of pixels that were supersampled
+size_t raytrace_adaptive(Buffer b, Scene s, Config c) {
+    assert(s.tt && "Error: Scene was not initialized");
+
+    Vec* colors = malloc(b.w * b.h * sizeof *colors);
+    Intersection* intrs = malloc(b.w * b.h * sizeof *intrs);
+
+    long y;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(config_threads(c))
+    for(y = 0; y < (long) b.h; y++) {
+        size_t x;
+        for(x = 0; x < b.w; x++) {
+            size_t i = x + (size_t) y * b.w;
+
+            Rng rng = rng_seed(i);
+
+            Ray r = camera_ray(s, b.h, b.w, x, (size_t) y);
+            colors[i] = cast_ray_primary(s, c, r, &rng, &intrs[i]);
+        }
+    }
+
+    size_t refined = 0;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(config_threads(c)) reduction(+:refined)
+    for(y = 0; y < (long) b.h; y++) {
+        size_t x;
+        for(x = 0; x < b.w; x++) {
+            size_t i = x + (size_t) y * b.w;
+
+            int edge = 0;
+            if(x > 0)
+                edge |= helper_raytrace_edge(colors, intrs, i, i - 1, c.aa_threshold);
+            if(x + 1 < b.w)
+                edge |= helper_raytrace_edge(colors, intrs, i, i + 1, c.aa_threshold);
+            if(y > 0)
+                edge |= helper_raytrace_edge(colors, intrs, i, i - b.w, c.aa_threshold);
+            if(y + 1 < (long) b.h)
+                edge |= helper_raytrace_edge(colors, intrs, i, i + b.w, c.aa_threshold);
+
+            Vec color = colors[i];
+            if(edge && c.aa_samples > 1) {
+                Rng rng = rng_seed(i + b.w * b.h);
+
+                size_t k;
+                for(k = 1; k < c.aa_samples; k++) {
+                    double jx = rng_next(&rng);
+                    double jy = rng_next(&rng);
+
+                    Ray r = camera_ray_at(s, b.h, b.w, (double) x + jx, (double) y + jy);
+                    color = add_vv(color, cast_ray(s, c, r, &rng));
+                }
+
+                color = div_vs(color, (double) c.aa_samples);
+                refined++;
+            }
+
+            buffer_set_pixel(b, x, (size_t) y, color);
+        }
+    }
+
+    free(colors);
+    free(intrs);
+
+    return refined;
+}
+
+// Combined `raytrace` function, `c.tile_costs` schedules blocks by their cost
+// Costs made for another image or block size are ignored, so one `Config` can render
+// `Buffer`s of any size
 void raytrace(Buffer b, Scene s, Config c) {
     assert(s.tt && "Error: Scene was not initialized");
 
-    if(c.threads == 1)
+    if(config_threads(c) == 1)
         helper_raytrace_standard(b, s, c);
+    else if(c.tile_costs && tile_costs_fit(c.tile_costs, b, c))
+        raytrace_scheduled(b, s, c, c.tile_costs);
     else 
         helper_raytrace_omp(b, s, c);
 
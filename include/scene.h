@@ -7,6 +7,11 @@
 
 #include "geom.h"
 #include "intrs.h"
+#include "lights.h"
+#include "qbvh.h"
+#include "grid.h"
+#include "pool.h"
+#include "numa.h"
 
 //
 // `Camera declaration
@@ -19,6 +24,9 @@ typedef struct Camera {
 //
 // `Config` declaration
 
+// Defined with the renderers, in rt.h
+typedef struct TileCosts TileCosts;
+
 typedef struct Config {
     double t_min;
     double t_max;
@@ -26,25 +34,66 @@ typedef struct Config {
     double ambience;
     size_t block_size;
     size_t threads;
+    Pool* pool;
+    size_t aa_samples;
+    double aa_threshold;
+    size_t max_depth;
+    size_t rr_depth;
+    double min_weight;
+    size_t wave_size;
+    size_t light_samples;
+    ShadowCache* shadow_cache;
+    ShadowStats* shadow_stats;
+    TileCosts* tile_costs;
+    void (*on_block)(void* data, size_t x, size_t y, size_t w, size_t h);
+    void* on_block_data;
 } Config;
 
+// The `Pool`'s thread count when there is one, otherwise `threads`, where 0 means
+// one thread per available core
+size_t config_threads(Config c) {
+    if(c.pool) return c.pool->threads;
+
+    return (c.threads) ? c.threads : pool_cores();
+}
+
 //
 // `ObjectMode` declaration
 
 typedef enum Motility { STATIC = 0, DYNAMIC } Motility;
 
+//
+// `Accelerator` declaration
+
+// ACCEL_BVH builds `tt` with the `Scene`'s `strategy`, ACCEL_GRID and ACCEL_GRID2 build
+// a one or two-level `Grid` instead, ACCEL_AUTO picks a two-level grid when
+// `grid_suitable` deems the STATIC surfaces dense and even enough
+typedef enum Accelerator { ACCEL_BVH = 0, ACCEL_GRID, ACCEL_GRID2, ACCEL_AUTO } Accelerator;
+
 //
 // `Scene` declaration
 
 typedef struct Scene {
     Camera camera;
     SLL* materials;
+    BVHStrategy strategy;
+    Accelerator accel;
+    int batch_spheres;
     BVH* tt;
+    BVH* dt;
+    QBVH* qt;
+    size_t nodes;
+    QBVH** replicas;
+    Grid* grid;
+    Grid* d_grid;
     SLL* lights;
+    LightGrid* lg;
     SLL* s_meshes;
     SLL* d_meshes;
     SLL* s_spheres;   
     SLL* d_spheres; 
+    size_t bc;
+    SphereBatch* batches;
     size_t ssc;
     Surface* s_surfaces;
     size_t dsc;
@@ -55,12 +104,24 @@ Scene scene_new(Camera c) {
     return (Scene) {
         .camera = c,
         .materials = NULL,
+        .strategy = MIDPOINT,
+        .accel = ACCEL_BVH,
+        .batch_spheres = 0,
         .tt = NULL,
+        .dt = NULL,
+        .qt = NULL,
+        .nodes = 0,
+        .replicas = NULL,
+        .grid = NULL,
+        .d_grid = NULL,
         .lights = NULL,
+        .lg = NULL,
         .s_meshes = NULL,
         .d_meshes = NULL,
         .s_spheres = NULL,
         .d_spheres = NULL,
+        .bc = 0,
+        .batches = NULL,
         .s_surfaces = NULL,
         .d_surfaces = NULL
     };
@@ -137,6 +198,190 @@ void helper_scene_surface_init(SLL* meshes, SLL* spheres, Surface** surfaces, si
     }
 }
 
+// Appends the index of every surface in `h` to `order`, leaf by leaf from left to right
+// Surfaces referenced by more than one leaf keep their first position
+void helper_scene_leaf_order(BVH* h, Surface* surfaces, size_t* order, size_t* oc, char* seen) {
+    if(!h) return;
+
+    if(!h->l && !h->r) {
+        SLL* curr;
+        for(curr = h->surfaces; curr; curr = curr->next) {
+            size_t i = (size_t) ((Surface*) curr->item - surfaces);
+
+            if(seen[i]) continue;
+
+            seen[i] = 1;
+            order[(*oc)++] = i;
+        }
+
+        return;
+    }
+
+    helper_scene_leaf_order(h->l, surfaces, order, oc, seen);
+    helper_scene_leaf_order(h->r, surfaces, order, oc, seen);
+}
+
+void helper_scene_leaf_remap(BVH* h, Surface* surfaces, size_t* position) {
+    if(!h) return;
+
+    SLL* curr;
+    for(curr = h->surfaces; curr; curr = curr->next)
+        curr->item = &surfaces[position[(Surface*) curr->item - surfaces]];
+
+    helper_scene_leaf_remap(h->l, surfaces, position);
+    helper_scene_leaf_remap(h->r, surfaces, position);
+}
+
+// Moves the `Surface`s built over `meshes`, and the `Tri`s inside each `Mesh`, into the
+// order `h`'s leaves visit them so that a leaf's primitives sit next to each other
+// The children of a node split space in two, so this order follows a space-filling curve
+// `surfaces` must still be laid out by `helper_scene_surface_init`. Spheres only have
+// their `Surface` moved since callers hold on to the `Sphere*` they were given
+void helper_scene_reorder(BVH* h, SLL* meshes, Surface* surfaces, size_t sc) {
+    size_t* order = malloc(MAX(1, sc) * sizeof *order);
+    size_t* position = malloc(MAX(1, sc) * sizeof *position);
+    char* seen = calloc(MAX(1, sc), 1);
+
+    size_t i, oc = 0;
+    helper_scene_leaf_order(h, surfaces, order, &oc, seen);
+
+    for(i = 0; i < sc; i++) if(!seen[i]) order[oc++] = i;
+    for(i = 0; i < sc; i++) position[order[i]] = i;
+
+    // Every mesh's `Tri`s take the order their `Surface`s now have
+    size_t mc = 0;
+
+    SLL* curr;
+    for(curr = meshes; curr; curr = curr->next) mc++;
+
+    Mesh** ms = malloc(MAX(1, mc) * sizeof *ms);
+    Tri** tris = malloc(MAX(1, mc) * sizeof *tris);
+    size_t* fill = calloc(MAX(1, mc), sizeof *fill);
+    size_t* owner = malloc(MAX(1, sc) * sizeof *owner);
+
+    size_t m = 0, base = 0;
+    for(curr = meshes; curr; curr = curr->next, m++) {
+        ms[m] = (Mesh*) curr->item;
+        tris[m] = malloc(MAX(1, ms[m]->tc) * sizeof **tris);
+
+        memcpy(tris[m], ms[m]->tris, ms[m]->tc * sizeof **tris);
+
+        for(i = base; i < base + ms[m]->tc; i++) owner[i] = m;
+        base += ms[m]->tc;
+    }
+
+    for(i = 0; i < sc; i++) {
+        size_t j = order[i];
+        if(j >= base) continue;
+
+        m = owner[j];
+
+        Tri* tri = &ms[m]->tris[fill[m]++];
+        *tri = tris[m][surfaces[j].tri - ms[m]->tris];
+
+        surfaces[j].tri = tri;
+    }
+
+    for(m = 0; m < mc; m++) free(tris[m]);
+
+    free(owner);
+    free(fill);
+    free(tris);
+    free(ms);
+
+    Surface* temp = malloc(MAX(1, sc) * sizeof *temp);
+    memcpy(temp, surfaces, sc * sizeof *temp);
+
+    for(i = 0; i < sc; i++) surfaces[i] = temp[order[i]];
+
+    helper_scene_leaf_remap(h, surfaces, position);
+
+    free(temp);
+    free(seen);
+    free(position);
+    free(order);
+}
+
+//
+// Sphere batching
+
+typedef struct SphereKey {
+    unsigned long long key;
+    Sphere* sphere;
+} SphereKey;
+
+// Spreads the low 21 bits of `v` three bits apart
+unsigned long long helper_scene_morton_spread(unsigned long long v) {
+    v &= 0x1FFFFF;
+    v = (v | v << 32) & 0x1F00000000FFFFULL;
+    v = (v | v << 16) & 0x1F0000FF0000FFULL;
+    v = (v | v << 8) & 0x100F00F00F00F00FULL;
+    v = (v | v << 4) & 0x10C30C30C30C30C3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+
+    return v;
+}
+
+unsigned long long helper_scene_morton(Vec p, Vec minima, Vec extent) {
+    double cells = (double) 0x1FFFFF;
+
+    unsigned long long x = (unsigned long long) (MAX(0., (p.x - minima.x) / MAX(DBL_MIN, extent.x)) * cells);
+    unsigned long long y = (unsigned long long) (MAX(0., (p.y - minima.y) / MAX(DBL_MIN, extent.y)) * cells);
+    unsigned long long z = (unsigned long long) (MAX(0., (p.z - minima.z) / MAX(DBL_MIN, extent.z)) * cells);
+
+    return helper_scene_morton_spread(x) 
+        | helper_scene_morton_spread(y) << 1 
+        | helper_scene_morton_spread(z) << 2;
+}
+
+int helper_scene_morton_cmp(const void* a, const void* b) {
+    unsigned long long ka = ((SphereKey*) a)->key;
+    unsigned long long kb = ((SphereKey*) b)->key;
+
+    return (ka > kb) - (ka < kb);
+}
+
+// Groups `spheres` into `SphereBatch`es of neighbours along a Morton curve of their centers
+void helper_scene_batch_spheres(SLL* spheres, SphereBatch** batches, size_t* bc) {
+    size_t i, n = 0;
+
+    SLL* curr;
+    for(curr = spheres; curr; curr = curr->next) n++;
+
+    SphereKey* keys = malloc(MAX(1, n) * sizeof *keys);
+
+    Vec minima = vec_aaa(DBL_MAX);
+    Vec maxima = vec_aaa(-1. * DBL_MAX);
+
+    for(curr = spheres, i = 0; curr; curr = curr->next, i++) {
+        keys[i].sphere = (Sphere*) curr->item;
+
+        helper_bvh_push_extrema(keys[i].sphere->center, &minima, &maxima);
+    }
+
+    for(i = 0; i < n; i++) 
+        keys[i].key = helper_scene_morton(keys[i].sphere->center, minima, sub_vv(maxima, minima));
+
+    qsort(keys, n, sizeof *keys, helper_scene_morton_cmp);
+
+    *bc = (n + SPHERE_BATCH - 1) / SPHERE_BATCH;
+    *batches = malloc(MAX(1, *bc) * sizeof **batches);
+
+    for(i = 0; i < *bc; i++) {
+        Sphere* group[SPHERE_BATCH];
+
+        size_t j, count = MIN(SPHERE_BATCH, n - i * SPHERE_BATCH);
+        for(j = 0; j < count; j++) group[j] = keys[i * SPHERE_BATCH + j].sphere;
+
+        (*batches)[i] = sphere_batch_new(group, count);
+    }
+
+    free(keys);
+}
+
+// With `batch_spheres` set, STATIC spheres enter the hierarchy as `SphereBatch`es
+// Batches copy the spheres, so STATIC spheres must not change after initialization
+// When a `Grid` is chosen `tt` only holds its bounds, like after `scene_compress`
 void scene_initialize(Scene* s) {
     assert(!s->tt &&
         "Error: BVH has been previously initialized");
@@ -145,10 +390,158 @@ void scene_initialize(Scene* s) {
     assert((s->s_meshes || s->d_meshes || s->s_spheres || s->d_spheres) &&
         "Error: The provided Scene has no drawable objects");
 
-    helper_scene_surface_init(s->s_meshes, s->s_spheres, &s->s_surfaces, &s->ssc);
+    if(s->batch_spheres) {
+        helper_scene_batch_spheres(s->s_spheres, &s->batches, &s->bc);
+        helper_scene_surface_init(s->s_meshes, NULL, &s->s_surfaces, &s->ssc);
+
+        s->s_surfaces = realloc(s->s_surfaces, MAX(1, s->ssc + s->bc) * sizeof *(s->s_surfaces));
+
+        size_t i;
+        for(i = 0; i < s->bc; i++)
+            s->s_surfaces[s->ssc++] = (Surface) { .st = BATCH, .batch = &s->batches[i] };
+    } else helper_scene_surface_init(s->s_meshes, s->s_spheres, &s->s_surfaces, &s->ssc);
+
     helper_scene_surface_init(s->d_meshes, s->d_spheres, &s->d_surfaces, &s->dsc);
 
-    s->tt = bvh_initialize(s->ssc, s->s_surfaces);
+    int grid = s->ssc && (s->accel == ACCEL_GRID || s->accel == ACCEL_GRID2 ||
+        (s->accel == ACCEL_AUTO && grid_suitable(s->ssc, s->s_surfaces)));
+
+    if(grid) {
+        s->grid = grid_new(s->ssc, s->s_surfaces, s->accel != ACCEL_GRID);
+        s->tt = helper_bvh_leaf(NULL, 0, s->grid->minima, s->grid->maxima);
+    } else {
+        s->tt = bvh_initialize_strategy(s->ssc, s->s_surfaces, s->strategy);
+        helper_scene_reorder(s->tt, s->s_meshes, s->s_surfaces, s->ssc);
+    }
+
+    s->lg = light_grid_new(s->lights);
+}
+
+// Rebuilds the `LightGrid` after lights are added, moved or resized post-initialization
+void scene_update_lights(Scene* s) {
+    light_grid_free(s->lg);
+
+    s->lg = light_grid_new(s->lights);
+}
+
+// Builds a hierarchy, or a `Grid` if the STATIC surfaces use one, over the DYNAMIC
+// surfaces, which are otherwise tested one by one
+// Once it exists `scene_refit` must be called after DYNAMIC objects are transformed
+void scene_track_dynamic(Scene* s) {
+    assert(s->tt && "Error: Scene was not initialized");
+
+    if(s->dt || s->d_grid || !s->dsc) return;
+
+    if(s->grid) {
+        s->d_grid = grid_new(s->dsc, s->d_surfaces, s->accel != ACCEL_GRID);
+        return;
+    }
+
+    s->dt = bvh_initialize_strategy(s->dsc, s->d_surfaces, s->strategy);
+    helper_scene_reorder(s->dt, s->d_meshes, s->d_surfaces, s->dsc);
+}
+
+// Grids build in linear time, so they are rebuilt rather than refit
+void scene_refit(Scene* s) {
+    if(s->dt) bvh_refit(s->dt);
+
+    if(s->d_grid) {
+        int two_level = s->d_grid->sub != NULL;
+
+        grid_free(s->d_grid);
+        s->d_grid = grid_new(s->dsc, s->d_surfaces, two_level);
+    }
+}
+
+// Replaces the static hierarchy with a `QBVH` whose child bounds take `bits` (8 or 16)
+// bits per coordinate. `tt` keeps only its root bounds afterwards
+void scene_compress(Scene* s, size_t bits) {
+    assert(s->tt && "Error: Scene was not initialized");
+    assert(!s->qt && "Error: Scene has already been compressed");
+    assert(!s->grid && "Error: Scene uses a Grid rather than a BVH");
+
+    s->qt = qbvh_new(s->tt, bits);
+
+    bvh_free(s->tt->l);
+    bvh_free(s->tt->r);
+
+    SLL* temp;
+    while(s->tt->surfaces) {
+        temp = s->tt->surfaces;
+        s->tt->surfaces = s->tt->surfaces->next;
+
+        free(temp);
+    }
+
+    s->tt->l = NULL;
+    s->tt->r = NULL;
+}
+
+void helper_scene_place(void* ptr, size_t len, size_t nodes, int huge) {
+    if(huge) numa_hugepages(ptr, len);
+
+    numa_spread(ptr, len, nodes);
+}
+
+// Spreads the STATIC scene data, first touched by the loading thread, over every NUMA
+// node, optionally behind transparent huge pages. With `replicate` set a compressed
+// hierarchy is copied to each node instead, see `scene_local`
+// Only `scene_compress`ed hierarchies are contiguous enough to place, `tt` is left as is
+void scene_distribute(Scene* s, int replicate, int huge) {
+    assert(s->tt && "Error: Scene was not initialized");
+    assert(!s->replicas && "Error: Scene has already been distributed");
+
+    size_t nodes = numa_nodes();
+
+    SLL* curr;
+    for(curr = s->s_meshes; curr; curr = curr->next) {
+        Mesh* mesh = (Mesh*) curr->item;
+
+        helper_scene_place(mesh->tris, mesh->tc * sizeof *(mesh->tris), nodes, huge);
+    }
+
+    helper_scene_place(s->s_surfaces, s->ssc * sizeof *(s->s_surfaces), nodes, huge);
+
+    if(s->batches) helper_scene_place(s->batches, s->bc * sizeof *(s->batches), nodes, huge);
+
+    if(s->grid) {
+        Grid* g = s->grid;
+
+        helper_scene_place(g->items, g->offsets[g->n[0] * g->n[1] * g->n[2]] * sizeof *(g->items), nodes, huge);
+        helper_scene_place(g->offsets, g->n[0] * g->n[1] * g->n[2] * sizeof *(g->offsets), nodes, huge);
+    }
+
+    if(!s->qt) return;
+
+    if(!replicate || nodes < 2) {
+        QBVH* q = s->qt;
+        size_t node_len = q->nc * ((q->bits == 8) ? sizeof *(q->n8) : sizeof *(q->n16));
+
+        helper_scene_place((q->bits == 8) ? (void*) q->n8 : (void*) q->n16, node_len, nodes, huge);
+        helper_scene_place(q->leaves, q->lc * sizeof *(q->leaves), nodes, huge);
+        helper_scene_place(q->items, q->rc * sizeof *(q->items), nodes, huge);
+
+        return;
+    }
+
+    s->nodes = nodes;
+    s->replicas = malloc(nodes * sizeof *(s->replicas));
+
+    size_t i;
+    for(i = 0; i < nodes; i++) {
+        s->replicas[i] = qbvh_replicate(s->qt, i, huge);
+
+        // Nodes without memory of their own share the original
+        if(!s->replicas[i]) s->replicas[i] = s->qt;
+    }
+}
+
+// The `Scene` as seen from the calling thread's NUMA node, call it once per worker
+// thread, after pinning, and trace with the copy
+Scene scene_local(Scene s) {
+    if(s.replicas) s.qt = s.replicas[numa_current_node() % s.nodes];
+
+    return s;
 }
 
 void scene_free(Scene* s) {
@@ -211,6 +604,20 @@ void scene_free(Scene* s) {
     }
 
     if(s->tt) bvh_free(s->tt);
+    if(s->dt) bvh_free(s->dt);
+    if(s->replicas) {
+        size_t i;
+        for(i = 0; i < s->nodes; i++)
+            if(s->replicas[i] != s->qt) qbvh_free(s->replicas[i]);
+
+        free(s->replicas);
+    }
+
+    if(s->qt) qbvh_free(s->qt);
+    if(s->grid) grid_free(s->grid);
+    if(s->d_grid) grid_free(s->d_grid);
+    if(s->batches) free(s->batches);
+    if(s->lg) light_grid_free(s->lg);
 
     if(s->s_surfaces) free(s->s_surfaces);
     if(s->d_surfaces) free(s->d_surfaces);
@@ -220,24 +627,26 @@ void scene_free(Scene* s) {
 // Intersection check
 
 Intersection intersection_check_excl(Scene s, Config c, Ray r, Surface e) {
-    Intersection intrs = helper_bvh_intersection(s.tt, r, e, c.t_min, c.t_max);
+    Intersection intrs = (s.grid) ?
+        grid_intersection(s.grid, r, e, c.t_min, c.t_max) :
+        (s.qt) ? 
+        qbvh_intersection(s.qt, r, e, c.t_min, c.t_max) : 
+        helper_bvh_intersection(s.tt, r, e, c.t_min, c.t_max);
+
+    if(s.dt || s.d_grid) {
+        Intersection dyn = (s.d_grid) ?
+            grid_intersection(s.d_grid, r, e, c.t_min, c.t_max) :
+            helper_bvh_intersection(s.dt, r, e, c.t_min, c.t_max);
+
+        return (dyn.t < intrs.t) ? dyn : intrs;
+    }
 
     size_t i;
     for(i = 0; i < s.dsc; i++) {
-        Surface sf = s.d_surfaces[i];
-
-        double t;
-        switch(sf.st) {
-            case TRI:
-                t = tri_intersection(*sf.tri, r, c.t_min, c.t_max);
-                break;
-            case SPHERE:
-                t = sphere_intersection(*sf.sphere, r, c.t_min, c.t_max);
-                break;
-            case NONE: continue;
-        }
+        Surface sf;
+        double t = surface_intersection_excl(s.d_surfaces[i], r, e, c.t_min, c.t_max, &sf);
 
-        if(t < intrs.t && !surface_match(e, sf)) {
+        if(t < intrs.t) {
             intrs.s = sf;
             intrs.t = t;
         }
@@ -246,6 +655,32 @@ Intersection intersection_check_excl(Scene s, Config c, Ray r, Surface e) {
     return intrs;
 }
 
+// Returns 1 if anything but `e` lies along `r`, testing the last occluder toward `l`
+// in `c.shadow_cache` first when the renderer provides one
+int shadow_check_excl(Scene s, Config c, Ray r, Surface e, Light* l) {
+    ShadowCache* sc = c.shadow_cache;
+
+    if(!sc) return intersection_check_excl(s, c, r, e).s.st != NONE;
+
+    sc->lookups++;
+
+    Surface occluder = shadow_cache_get(sc, l);
+    if(occluder.st && !surface_match(e, occluder) && 
+        surface_intersection(occluder, r, c.t_min, c.t_max) <= c.t_max) {
+        sc->occluded++;
+        sc->hits++;
+        return 1;
+    }
+
+    Intersection shadow = intersection_check_excl(s, c, r, e);
+    if(!shadow.s.st) return 0;
+
+    sc->occluded++;
+    shadow_cache_put(sc, l, shadow.s);
+
+    return 1;
+}
+
 Intersection intersection_check(Scene s, Config c, Ray r) {
     Surface e = (Surface) { .st = NONE };
 
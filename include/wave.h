@@ -0,0 +1,309 @@
+#ifndef WAVE_H
+#define WAVE_H
+
+#include<omp.h>
+
+#include "rt.h"
+
+#define WAVE_SIZE 65536
+#define WAVE_KEYS 64
+
+//
+// `WaveRay` declaration, a `PathRay` that remembers which pixel it belongs to
+
+typedef struct WaveRay {
+    PathRay pr;
+    size_t pixel;
+    unsigned key;
+} WaveRay;
+
+typedef struct WaveHit {
+    WaveRay wr;
+    Intersection intrs;
+    Vec normal;
+    Vec hit;
+    Light** ls;
+    size_t lc;
+    size_t shadow;
+} WaveHit;
+
+typedef struct WaveShadow {
+    Ray r;
+    size_t hit;
+    size_t light;
+    Surface excl;
+    unsigned key;
+} WaveShadow;
+
+//
+// Helper functions
+
+// Rays are bucketed by the octant of their direction, then of their origin about `center`
+unsigned helper_wave_key(Ray r, Vec center) {
+    unsigned key = 0;
+
+    key |= (r.dir.x < 0.) << 0;
+    key |= (r.dir.y < 0.) << 1;
+    key |= (r.dir.z < 0.) << 2;
+
+    key |= (r.origin.x < center.x) << 3;
+    key |= (r.origin.y < center.y) << 4;
+    key |= (r.origin.z < center.z) << 5;
+
+    return key;
+}
+
+// Stable counting sort on `key`, `temp` must hold `count` items
+#define WAVE_SORT(items, temp, count) do {                         \
+    size_t wave_buckets[WAVE_KEYS + 1] = { 0 };                    \
+    size_t wave_i;                                                 \
+    for(wave_i = 0; wave_i < (count); wave_i++)                    \
+        wave_buckets[(items)[wave_i].key + 1]++;                   \
+    for(wave_i = 1; wave_i <= WAVE_KEYS; wave_i++)                 \
+        wave_buckets[wave_i] += wave_buckets[wave_i - 1];          \
+    for(wave_i = 0; wave_i < (count); wave_i++)                    \
+        (temp)[wave_buckets[(items)[wave_i].key]++] = (items)[wave_i]; \
+    memcpy((items), (temp), (count) * sizeof *(items));            \
+} while(0)
+
+Vec helper_wave_center(Scene s) {
+    return mul_vs(add_vv(s.tt->minima, s.tt->maxima), 0.5);
+}
+
+//
+// Wavefront `raytrace` function
+
+// Traces the image in batches of `c.wave_size` pixels (or `WAVE_SIZE`), each stage
+// running over the whole batch: intersect, compact hits, cast every shadow ray,
+// shade and then spawn the next bounce as a new wave
+// Between stages the rays are sorted by direction and origin octant for coherence
+// Every light the grid finds gets a shadow ray, so `c.light_samples` is not supported
+void raytrace_wavefront(Buffer b, Scene s, Config c) {
+    assert(s.tt && "Error: Scene was not initialized");
+    assert(!c.light_samples && "Error: Wavefront rendering does not sample lights");
+
+    size_t wave = (c.wave_size) ? c.wave_size : WAVE_SIZE;
+    int threads = (int) config_threads(c);
+
+    size_t i;
+
+    Vec center = helper_wave_center(s);
+
+    // A hit can spawn both a reflection and a refraction, so waves of bounces may outgrow
+    // the batch. Ray arrays double as needed, `hcap` tracks those sized by hit
+    size_t cap = 2 * wave, hcap = cap;
+
+    // Shadow rays are cast in chunks of `sw`
+    size_t sw = 2 * wave;
+
+    WaveRay* rays = malloc(cap * sizeof *rays);
+    WaveRay* rays_temp = malloc(cap * sizeof *rays_temp);
+    WaveHit* hits = malloc(hcap * sizeof *hits);
+    Intersection* intrs = malloc(hcap * sizeof *intrs);
+    WaveShadow* shadows = malloc(sw * sizeof *shadows);
+    WaveShadow* shadows_temp = malloc(sw * sizeof *shadows_temp);
+    size_t oc = sw;
+    char* occluded = malloc(oc);
+    Vec* shade = malloc(hcap * sizeof *shade);
+    Vec* colors = malloc(wave * sizeof *colors);
+
+    size_t start;
+    for(start = 0; start < b.w * b.h; start += wave) {
+        size_t count = MIN(wave, b.w * b.h - start);
+
+        long j;
+
+        // Generate primary rays
+        #pragma omp parallel for num_threads(threads)
+        for(j = 0; j < (long) count; j++) {
+            size_t p = start + (size_t) j;
+
+            Ray r = camera_ray(s, b.h, b.w, p % b.w, p / b.w);
+
+            rays[j] = (WaveRay) {
+                .pr = (PathRay) {
+                    .r = r,
+                    .weight = vec_aaa(1.),
+                    .depth = 0,
+                    .excl = (Surface) { .st = NONE }
+                },
+                .pixel = (size_t) j,
+                .key = helper_wave_key(r, center)
+            };
+
+            colors[j] = vec_aaa(0.);
+        }
+
+        size_t rc = count;
+        while(rc) {
+            if(rc > hcap) {
+                hcap = cap;
+                hits = realloc(hits, hcap * sizeof *hits);
+                intrs = realloc(intrs, hcap * sizeof *intrs);
+                shade = realloc(shade, hcap * sizeof *shade);
+            }
+
+            WAVE_SORT(rays, rays_temp, rc);
+
+            // Intersect the whole wave
+            #pragma omp parallel for schedule(dynamic, 64) num_threads(threads)
+            for(j = 0; j < (long) rc; j++)
+                intrs[j] = intersection_check_excl(s, c, rays[j].pr.r, rays[j].pr.excl);
+
+            // Compact hits, misses contribute nothing
+            size_t hc = 0;
+            for(i = 0; i < rc; i++)
+                if(intrs[i].s.st) hits[hc++] = (WaveHit) { .wr = rays[i], .intrs = intrs[i] };
+
+            #pragma omp parallel for num_threads(threads)
+            for(j = 0; j < (long) hc; j++) {
+                intersection_normal(hits[j].intrs, hits[j].wr.pr.r, &hits[j].normal, &hits[j].hit);
+
+                hits[j].lc = light_grid_query(s.lg, hits[j].hit, &hits[j].ls);
+            }
+
+            // Each hit's shadow rays start at the running total of the lights before it
+            size_t st = 0;
+            for(i = 0; i < hc; i++) {
+                hits[i].shadow = st;
+                st += hits[i].lc;
+            }
+
+            if(st > oc) {
+                oc = st;
+                occluded = realloc(occluded, oc);
+            }
+
+            // Cast a shadow ray from every hit toward every light reaching it, a wave at a time
+            size_t sp, h0 = 0;
+            for(sp = 0; sp < st; sp += sw) {
+                size_t sc = MIN(sw, st - sp);
+
+                while(hits[h0].shadow + hits[h0].lc <= sp) h0++;
+
+                #pragma omp parallel for num_threads(threads)
+                for(j = 0; j < (long) sc; j++) {
+                    size_t k = sp + (size_t) j;
+
+                    // Find the hit owning shadow ray `k` by searching forward from `h0`
+                    size_t lo = h0, hi = hc - 1;
+                    while(lo < hi) {
+                        size_t mid = (lo + hi + 1) / 2;
+
+                        if(hits[mid].shadow <= k) lo = mid;
+                        else hi = mid - 1;
+                    }
+
+                    WaveHit* wh = &hits[lo];
+                    Light* l = wh->ls[k - wh->shadow];
+
+                    Ray r = (Ray) {
+                        .origin = wh->hit,
+                        .dir = norm_v(sub_vv(l->pos, wh->hit))
+                    };
+
+                    shadows[j] = (WaveShadow) {
+                        .r = r,
+                        .hit = lo,
+                        .light = k - wh->shadow,
+                        .excl = wh->intrs.s,
+                        .key = helper_wave_key(r, center)
+                    };
+                }
+
+                WAVE_SORT(shadows, shadows_temp, sc);
+
+                #pragma omp parallel for schedule(dynamic, 64) num_threads(threads)
+                for(j = 0; j < (long) sc; j++) {
+                    WaveShadow* ws = &shadows[j];
+                    WaveHit* wh = &hits[ws->hit];
+
+                    // Lights attenuated to nothing need no shadow ray
+                    char blocked = light_attenuation(wh->ls[ws->light], wh->hit) <= 0.;
+
+                    if(!blocked) blocked = intersection_check_excl(s, c, ws->r, ws->excl).s.st != NONE;
+
+                    occluded[wh->shadow + ws->light] = blocked;
+                }
+            }
+
+            // Shade every hit
+            #pragma omp parallel for num_threads(threads)
+            for(j = 0; j < (long) hc; j++) {
+                WaveHit* wh = &hits[j];
+
+                Material* material = intersection_material(wh->intrs);
+
+                Vec local = mul_vs(material->color_ambient, c.ambience);
+
+                size_t k;
+                for(k = 0; k < wh->lc; k++) {
+                    if(occluded[wh->shadow + k]) continue;
+
+                    Light* l = wh->ls[k];
+
+                    Ray light_ray = (Ray) {
+                        .origin = wh->hit,
+                        .dir = norm_v(sub_vv(l->pos, wh->hit))
+                    };
+
+                    Vec light = helper_cast_light(material, wh->wr.pr.r, wh->normal, *l, light_ray);
+                    light = mul_vs(light, light_attenuation(l, wh->hit));
+                    local = add_vv(local, light);
+                }
+
+                Vec retained = helper_cast_retained(wh->wr.pr, material);
+
+                shade[j] = (Vec) {
+                    retained.x * local.x,
+                    retained.y * local.y,
+                    retained.z * local.z
+                };
+            }
+
+            // Accumulate serially since bounces of one pixel share its color
+            for(i = 0; i < hc; i++)
+                colors[hits[i].wr.pixel] = add_vv(colors[hits[i].wr.pixel], shade[i]);
+
+            // Spawn the next wave from reflected and refracted bounces
+            rc = 0;
+            for(i = 0; i < hc; i++) {
+                WaveHit* wh = &hits[i];
+
+                PathRay bounces[2];
+
+                size_t k, bc = helper_cast_bounce(c, wh->wr.pr, wh->intrs, wh->normal, wh->hit, bounces);
+                for(k = 0; k < bc; k++) {
+                    if(!helper_cast_survives(c, NULL, &bounces[k])) continue;
+
+                    if(rc == cap) {
+                        cap *= 2;
+                        rays = realloc(rays, cap * sizeof *rays);
+                        rays_temp = realloc(rays_temp, cap * sizeof *rays_temp);
+                    }
+
+                    rays[rc++] = (WaveRay) {
+                        .pr = bounces[k],
+                        .pixel = wh->wr.pixel,
+                        .key = helper_wave_key(bounces[k].r, center)
+                    };
+                }
+            }
+        }
+
+        for(i = 0; i < count; i++)
+            buffer_set_pixel(b, (start + i) % b.w, (start + i) / b.w, clamp_v(colors[i], 0., 1.));
+    }
+
+    free(rays);
+    free(rays_temp);
+    free(hits);
+    free(intrs);
+    free(shadows);
+    free(shadows_temp);
+    free(occluded);
+    free(shade);
+    free(colors);
+}
+
+#endif /* WAVE_H */
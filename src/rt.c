@@ -1,20 +1,65 @@
+#include<string.h>
+
 #include "rt.h"
+#include "anim.h"
+#include "dirty.h"
+#include "out.h"
+#include "proc.h"
+#include "daemon.h"
+#include "live.h"
+#include "pace.h"
+#include "job.h"
+#include "wave.h"
 
 #define TEAPOT "C:/Users/hank/Documents/projects/rt.c/models/uteapot"
 
 //
 // Main function
 
-int main(void) {
+int main(int argc, char** argv) {
+    // `--bvh-report` prints statistics on the static hierarchy instead of rendering
+    int report = argc > 1 && !strcmp(argv[1], "--bvh-report");
+
+    // `--wavefront` renders with the batched wavefront pipeline
+    int wavefront = argc > 1 && !strcmp(argv[1], "--wavefront");
+
+    // `--sequence` renders a short animation of the DYNAMIC sphere
+    int sequence = argc > 1 && !strcmp(argv[1], "--sequence");
+
+    // `--processes` renders with forked worker processes instead of threads
+    int processes = argc > 1 && !strcmp(argv[1], "--processes");
+
+    // `--daemon` keeps the scene resident and serves render requests on `rt.sock`
+    int serve = argc > 1 && !strcmp(argv[1], "--daemon");
+
+    // `--live` renders into the shared memory segment `/rt-live` for viewers to watch
+    int live = argc > 1 && !strcmp(argv[1], "--live");
+
+    // `--paced` renders a camera pan and then a still view, each frame within 1/30 s
+    int paced = argc > 1 && !strcmp(argv[1], "--paced");
+
+    // `--job` cancels a background render halfway, checkpoints it and resumes from the file
+    int job = argc > 1 && !strcmp(argv[1], "--job");
+
+    // `--pin`, given after any of the above, binds each render thread to its own core
+    int pin = 0;
+
+    int arg;
+    for(arg = 1; arg < argc; arg++) pin |= !strcmp(argv[arg], "--pin");
+
     Config config = (Config) {
         .t_min = 0.01,
         .t_max = 1000.,
         .fov = 1.570796,
         .ambience = 0.2,
         .block_size = 10,
-        .threads = 8
+        .threads = 0
     };
 
+    // One thread per core, kept for the whole run and pinned with `--pin`
+    Pool* pool = pool_new(config.threads, pin);
+    config.pool = pool;
+
     Camera camera = (Camera) { 
         .pos = vec_abc(0., 10., -15.0), 
         .at = vec_aaa(0.) 
@@ -80,20 +125,139 @@ int main(void) {
     // Initialize the scene
     scene_initialize(&scene);
 
+    if(report) {
+        BVHReport rep = bvh_report(scene.tt);
+        bvh_report_print(&rep);
+        bvh_report_free(&rep);
+
+        bvh_report_compare(scene.ssc, scene.s_surfaces, MIDPOINT, SAH);
+        bvh_report_compare(scene.ssc, scene.s_surfaces, SAH, SBVH);
+
+        size_t bits;
+        for(bits = 8; bits <= 16; bits += 8) {
+            QBVH* q = qbvh_new(scene.tt, bits);
+            qbvh_print(q);
+            qbvh_free(q);
+        }
+
+        scene_free(&scene); pool_free(pool);
+
+        return 0;
+    }
+
+    if(serve) {
+        Daemon* d = daemon_new("rt.sock");
+
+        size_t id = daemon_add_scene(d, &scene);
+        daemon_expose_sphere(d, id, dyn_sphere);
+
+        if(daemon_run(d, config)) printf("Failed to listen on rt.sock\n");
+
+        daemon_free(d); scene_free(&scene); pool_free(pool);
+
+        return 0;
+    }
+
+    if(sequence) {
+        Sequence seq = sequence_new(24);
+
+        Transform ts[24];
+
+        size_t i;
+        for(i = 0; i < 24; i++) ts[i] = transform_translate(vec_abc(0., 0.5, -0.25));
+
+        sequence_add_sphere_track(&seq, dyn_sphere, ts);
+
+        sequence_add_keyframe(&seq, 0, camera);
+        sequence_add_keyframe(&seq, 23, (Camera) { 
+            .pos = vec_abc(10., 10., -12.), 
+            .at = vec_aaa(0.) 
+        } );
+
+        if(raytrace_sequence(&scene, config, &seq, 640, 360, "frame_%02u.ppm", PPM))
+            printf("Failed to write one or more frames\n");
+
+        sequence_free(&seq); scene_free(&scene); pool_free(pool);
+
+        printf("Complete...\n");
+
+        return 0;
+    }
+
     // Demonstrate that transforming a DYNAMIC object after initialization is allowed
     sphere_transform(dyn_sphere, transform_translate(vec_abc(0., 1., -1.)));
     
     // Create a new `Buffer`
     Buffer b = buffer_wh(640, 360);
 
-    // Write the ray traced image to the `Buffer`
-    raytrace(b, scene, config);
+    // Write the ray traced image to the `Buffer` and export it as a PPM image
+    // Without `--wavefront` rows are written in the background as they complete
+    if(wavefront) {
+        raytrace_wavefront(b, scene, config);
+        buffer_export_as_ppm(b, "test.ppm");
+    } else if(live) {
+        Live* l = live_open("/rt-live", b.w, b.h, config.block_size);
+
+        if(l) {
+            raytrace_live(l, scene, config);
+            buffer_export_as_ppm(l->b, "test.ppm");
+        } else printf("Failed to open /rt-live\n");
+
+        live_close(l);
+    } else if(paced) {
+        Pacer p = pacer_new(1. / 30., 0.25);
+
+        unsigned i;
+        for(i = 0; i < 16; i++) {
+            scene.camera.pos = vec_abc(0.5 * (double) MIN(i, 8), 10., -15.);
+
+            double t = raytrace_paced(b, scene, config, &p);
+            printf("Frame %2u: %zux%zu in %.1fms\n", i, p.w, p.h, 1000. * t);
+        }
+
+        buffer_export_as_ppm(b, "test.ppm");
+
+        pacer_free(&p);
+    } else if(job) {
+        Job* j = job_new(b, scene, config);
+
+        size_t total;
+        job_progress(j, &total);
+
+        if(job_start(j)) {
+            printf("Failed to start the job\n");
+            job_free(j);
+        } else {
+            while(job_progress(j, NULL) < total / 2) usleep(1000);
+
+            job_cancel(j);
+            printf("Cancelled at %zu of %zu blocks\n", job_progress(j, NULL), total);
+
+            if(job_checkpoint(j, "test.ckpt")) printf("Failed to write test.ckpt\n");
+            job_free(j);
+
+            // A fresh job, as after a restart, picks up the remaining blocks from the checkpoint
+            Job* resumed = job_new(b, scene, config);
+
+            if(job_restore(resumed, "test.ckpt")) printf("Failed to restore test.ckpt\n");
+            else printf("Resuming from %zu of %zu blocks\n", job_progress(resumed, NULL), total);
+
+            if(job_start(resumed) || job_wait(resumed)) printf("Failed to finish the job\n");
+
+            buffer_export_as_ppm(b, "test.ppm");
+
+            job_free(resumed);
+        }
+    } else if(processes) {
+        if(raytrace_processes(b, scene, config, 0))
+            printf("Failed to render one or more blocks\n");
 
-    // Export `Buffer` as a PPM image
-    buffer_export_as_ppm(b, "test.ppm");
+        buffer_export_as_ppm(b, "test.ppm");
+    } else if(raytrace_to_file(b, scene, config, "test.ppm", PPM))
+        printf("Failed to write test.ppm\n");
 
     // Free memory before exit
-    scene_free(&scene); buffer_free(&b);
+    scene_free(&scene); buffer_free(&b); pool_free(pool);
 
     printf("Complete...\n");
 